@@ -0,0 +1,285 @@
+#include "./binlog.h"
+#include "./util.h"
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sylar {
+
+const char BinLog::kMagic[8] = {'S', 'Y', 'L', 'B', 'I', 'N', '2', '\0'};
+const size_t BinLog::kEventHeaderSize;
+
+namespace {
+
+struct BinLogState {
+    std::mutex mutex;
+    std::ofstream file;
+    std::string path;
+    std::string defines; // 全部定义记录, 切换文件时重新写入
+    uint32_t siteId = 0;
+    uint32_t loggerId = 0;
+};
+
+struct ThreadBuffer;
+
+// 定时写出线程与已注册的线程本地缓冲
+// 锁顺序: FlusherState::mutex -> ThreadBuffer::mutex -> BinLogState::mutex
+struct FlusherState {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<ThreadBuffer *> buffers;
+    std::thread thread;
+    bool stop = false;
+};
+
+FlusherState &GetFlusher() {
+    static FlusherState *s_flusher = new FlusherState;
+    return *s_flusher;
+}
+
+// 不析构, 保证线程本地缓冲在退出阶段写出时仍可用
+BinLogState &GetState() {
+    static BinLogState *s_state = new BinLogState;
+    return *s_state;
+}
+
+// 线程本地缓冲, 线程退出时写出
+// mutex 由所属线程在 Reserve 到 Commit 之间持有, 与定时写出线程互斥, 通常无竞争
+struct ThreadBuffer {
+    static const size_t kSize = 64 * 1024;
+    static const uint64_t kFlushInterval = 1000 * 1000 * 1000;
+
+    std::mutex mutex;
+    bool registered = false;
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+    std::string large;  // 超过缓冲大小的单条记录
+    bool useLarge = false;
+    uint64_t now = 0;   // 当前记录的时间戳
+    uint64_t lastFlush = 0;
+    uint32_t threadId = 0; // 注册时取一次, 避免每条记录调用 GetThreadId
+
+    ~ThreadBuffer() {
+        if (registered) {
+            FlusherState &flusher = GetFlusher();
+            std::lock_guard<std::mutex> lock(flusher.mutex);
+            auto &v = flusher.buffers;
+            v.erase(std::remove(v.begin(), v.end(), this), v.end());
+        }
+        lockedFlush(false);
+    }
+
+    void lockedFlush(bool sync) {
+        std::lock_guard<std::mutex> lock(mutex);
+        flush(sync);
+    }
+
+    // 调用方持有 mutex
+    void flush(bool sync) {
+        BinLogState &state = GetState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.file) {
+            if (size) state.file.write(data.get(), size);
+            if (useLarge) state.file.write(large.data(), large.size());
+            if (sync) state.file.flush();
+        }
+        size = 0;
+        useLarge = false;
+        lastFlush = now;
+    }
+};
+
+thread_local ThreadBuffer t_buffer;
+
+void FlusherRun() {
+    FlusherState &flusher = GetFlusher();
+    std::unique_lock<std::mutex> lock(flusher.mutex);
+    while (!flusher.stop) {
+        flusher.cond.wait_for(lock, std::chrono::nanoseconds((int64_t)ThreadBuffer::kFlushInterval));
+        if (flusher.stop) break;
+        uint64_t now = GetRealtimeNS();
+        for (auto buf : flusher.buffers) {
+            std::lock_guard<std::mutex> block(buf->mutex);
+            if ((buf->size || buf->useLarge) && now - buf->lastFlush >= ThreadBuffer::kFlushInterval) {
+                buf->now = now;
+                buf->flush(true);
+            }
+        }
+    }
+}
+
+void StartFlusher() {
+    FlusherState &flusher = GetFlusher();
+    std::lock_guard<std::mutex> lock(flusher.mutex);
+    if (flusher.thread.joinable()) return;
+    flusher.stop = false;
+    flusher.thread = std::thread(FlusherRun);
+}
+
+void StopFlusher() {
+    FlusherState &flusher = GetFlusher();
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(flusher.mutex);
+        flusher.stop = true;
+        thread.swap(flusher.thread);
+    }
+    flusher.cond.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+template <typename T>
+void Append(std::string &str, T v) {
+    str.append((const char *)&v, sizeof(v));
+}
+
+void AppendString(std::string &str, const char *v, size_t len) {
+    uint16_t n = len > 0xFFFF ? 0xFFFF : len;
+    Append(str, n);
+    str.append(v, n);
+}
+
+void WriteDefine(BinLogState &state, const std::string &record) {
+    state.defines.append(record);
+    if (state.file) {
+        state.file.write(record.data(), record.size());
+        state.file.flush();
+    }
+}
+
+} // namespace
+
+bool BinLog::Open(const std::string &file) {
+    t_buffer.lockedFlush(true);
+    {
+        BinLogState &state = GetState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.file.is_open()) {
+            state.file.close();
+        }
+        state.path = file;
+        state.file.clear();
+        state.file.open(file, std::ios::binary | std::ios::app);
+        if (!state.file) return false;
+        if (state.file.tellp() == 0) {
+            state.file.write(kMagic, sizeof(kMagic));
+        }
+        // 同一文件可能由多个进程先后追加, 每次打开都写入本进程的启动时间
+        std::string record(1, 'P');
+        Append(record, MonotonicToRealtimeNS(GetStartNS()));
+        state.file.write(record.data(), record.size());
+        state.file.write(state.defines.data(), state.defines.size());
+        state.file.flush();
+        if (!state.file) return false;
+    }
+    StartFlusher();
+    return true;
+}
+
+void BinLog::Close() {
+    StopFlusher();
+    t_buffer.lockedFlush(true);
+    BinLogState &state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.file.close();
+    state.path.clear();
+}
+
+std::string BinLog::GetFile() {
+    BinLogState &state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.path;
+}
+
+uint32_t BinLog::DefineLogger(uint32_t id, const std::string &name, const std::string &pattern) {
+    BinLogState &state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (!id) id = ++state.loggerId;
+    std::string record(1, 'L');
+    Append(record, id);
+    AppendString(record, name.data(), name.size());
+    AppendString(record, pattern.data(), pattern.size());
+    WriteDefine(state, record);
+    return id;
+}
+
+uint32_t BinLog::RegisterSite(Site &site, int level, const char *file, int line, const char *fmt) {
+    BinLogState &state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    uint32_t id = site.id.load(std::memory_order_relaxed);
+    if (id) return id;
+    id = ++state.siteId;
+    std::string record(1, 'S');
+    Append(record, id);
+    Append(record, (uint8_t)level);
+    Append(record, (int32_t)line);
+    AppendString(record, file, strlen(file));
+    AppendString(record, fmt, strlen(fmt));
+    WriteDefine(state, record);
+    site.id.store(id, std::memory_order_release);
+    return id;
+}
+
+char *BinLog::Reserve(size_t size) {
+    ThreadBuffer &buf = t_buffer;
+    if (!buf.registered) {
+        FlusherState &flusher = GetFlusher();
+        std::lock_guard<std::mutex> lock(flusher.mutex);
+        flusher.buffers.push_back(&buf);
+        buf.registered = true;
+        buf.threadId = GetThreadId();
+    }
+    // 在 Commit 中释放
+    buf.mutex.lock();
+    if (!buf.data) {
+        buf.data.reset(new char[ThreadBuffer::kSize]);
+    }
+    if (buf.size + size > ThreadBuffer::kSize) {
+        buf.flush(false);
+    }
+    if (size > ThreadBuffer::kSize) {
+        buf.large.resize(size);
+        buf.useLarge = true;
+        return &buf.large[0];
+    }
+    return buf.data.get() + buf.size;
+}
+
+char *BinLog::Header(char *p, uint32_t site, uint32_t logger, int level, uint8_t nargs) {
+    ThreadBuffer &buf = t_buffer;
+    uint64_t now = GetRealtimeNS();
+    buf.now = now;
+    *p++ = 'E';
+    memcpy(p, &site, 4);
+    memcpy(p + 4, &logger, 4);
+    // 同一调用点可能以不同级别写入(如 SYLAR_LOG_FMT_LEVEL), 级别随事件记录
+    p[8] = (uint8_t)level;
+    uint32_t fiber_id = GetFiberId();
+    memcpy(p + 9, &buf.threadId, 4);
+    memcpy(p + 13, &fiber_id, 4);
+    memcpy(p + 17, &now, 8);
+    p[25] = nargs;
+    return p + 26;
+}
+
+void BinLog::Commit(size_t size, int level) {
+    ThreadBuffer &buf = t_buffer;
+    if (!buf.useLarge) {
+        buf.size += size;
+    }
+    // Fatal(5) 立即落盘
+    if (level >= 5 || buf.useLarge || buf.now - buf.lastFlush >= ThreadBuffer::kFlushInterval) {
+        buf.flush(level >= 5);
+    }
+    buf.mutex.unlock();
+}
+
+void BinLog::Flush() {
+    t_buffer.lockedFlush(true);
+}
+
+} // namespace sylar
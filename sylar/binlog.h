@@ -0,0 +1,110 @@
+#ifndef __SYLAR_BINLOG_H__
+#define __SYLAR_BINLOG_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace sylar {
+
+// 二进制日志(延迟格式化)
+// 开启二进制模式的 Logger, 其 SYLAR_LOG_FMT_* 只记录格式串 id 与参数的原始字节,
+// 写入线程本地缓冲, 缓冲满 / 超过 1 秒 / Fatal 时整块写入文件,
+// 后台线程每秒写出空闲线程中超过 1 秒未写出的缓冲
+// 文本由 log_decode 工具按 Logger 的 LogFormatter pattern 离线还原
+//
+// 文件格式: 8 字节魔数 "SYLBIN2", 之后为连续的记录, 首字节为记录类型
+//   'P' 进程信息:   u64 进程启动时的纳秒时间戳, 每次 Open 写入, 用于还原 elapse
+//   'S' 调用点定义: u32 id, u8 level, i32 line, u16 len + file, u16 len + fmt
+//   'L' Logger 定义: u32 id, u16 len + name, u16 len + pattern (同 id 以最后一次为准)
+//   'E' 日志事件:   u32 site, u32 logger, u8 level, u32 thread, u32 fiber, u64 纳秒时间戳, u8 参数个数, 参数
+//   参数: u8 类型 + 数据, 'i' int64 / 'u' uint64 / 'd' double / 'p' uint64 / 's' u32 len + bytes
+class BinLog {
+public:
+    static const char kMagic[8];
+
+    // 调用点, 每个 SYLAR_LOG_FMT_* 展开处一个静态实例
+    struct Site {
+        std::atomic<uint32_t> id;
+    };
+
+    // 打开(或切换)二进制日志文件, 已注册的调用点与 Logger 定义会重新写入新文件
+    static bool Open(const std::string &file);
+    static void Close();
+    static std::string GetFile();
+
+    // 注册/更新 Logger, id 为 0 时分配新 id, 返回 id
+    static uint32_t DefineLogger(uint32_t id, const std::string &name, const std::string &pattern);
+
+    static uint32_t GetSiteId(Site &site, int level, const char *file, int line, const char *fmt) {
+        uint32_t id = site.id.load(std::memory_order_acquire);
+        return id ? id : RegisterSite(site, level, file, line, fmt);
+    }
+
+    template <typename... Args>
+    static void Write(uint32_t logger, uint32_t site, int level, Args... args) {
+        size_t size = kEventHeaderSize;
+        int sizes[] = {0, (size += ArgSize(args), 0)...};
+        (void)sizes;
+        char *p = Reserve(size);
+        p = Header(p, site, logger, level, sizeof...(Args));
+        int encodes[] = {0, (p = Encode(p, args), 0)...};
+        (void)encodes;
+        Commit(size, level);
+    }
+
+    // 写出当前线程的缓冲
+    static void Flush();
+
+private:
+    static const size_t kEventHeaderSize = 1 + 4 * 2 + 1 + 4 * 2 + 8 + 1;
+
+    static uint32_t RegisterSite(Site &site, int level, const char *file, int line, const char *fmt);
+    static char *Reserve(size_t size);
+    static char *Header(char *p, uint32_t site, uint32_t logger, int level, uint8_t nargs);
+    static void Commit(size_t size, int level);
+
+    template <typename T>
+    static char *Put(char *p, char type, T v) {
+        *p++ = type;
+        memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    }
+
+    // 整数与枚举统一按 64 位记录, 浮点按 double 记录
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type
+    ArgSize(T) { return 1 + 8; }
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value, size_t>::type
+    ArgSize(T) { return 1 + 8; }
+    static size_t ArgSize(const char *v) { return 1 + 4 + (v ? strlen(v) : 0); }
+    static size_t ArgSize(char *v) { return ArgSize((const char *)v); }
+    template <typename T>
+    static size_t ArgSize(T *) { return 1 + 8; }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, char *>::type
+    Encode(char *p, T v) { return Put(p, 'u', (uint64_t)v); }
+    template <typename T>
+    static typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value) || std::is_enum<T>::value, char *>::type
+    Encode(char *p, T v) { return Put(p, 'i', (int64_t)v); }
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value, char *>::type
+    Encode(char *p, T v) { return Put(p, 'd', (double)v); }
+    static char *Encode(char *p, const char *v) {
+        uint32_t len = v ? strlen(v) : 0;
+        p = Put(p, 's', len);
+        memcpy(p, v, len);
+        return p + len;
+    }
+    static char *Encode(char *p, char *v) { return Encode(p, (const char *)v); }
+    template <typename T>
+    static char *Encode(char *p, T *v) { return Put(p, 'p', (uint64_t)(uintptr_t)v); }
+};
+
+} // namespace sylar
+
+#endif // __SYLAR_BINLOG_H__
@@ -1,9 +1,18 @@
 #include "./log.h"
 #include "./config.h"
+#include "./ring_queue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdarg>
+#include <cstring>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <set>
 
 namespace sylar {
@@ -56,11 +65,149 @@ void from_json(const nlohmann::json &j, LogLevel::Level &v) {
 }
 
 LogEventWrap::LogEventWrap(LogEvent::ptr e)
-    : m_event(e) {
+    : m_event(std::move(e)) {
 }
 
 LogEventWrap::~LogEventWrap() {
     m_event->getLogger()->log(m_event->getLevel(), m_event);
+    LogEvent::Release(m_event);
+}
+
+const size_t LogStream::kInlineSize;
+
+LogStream::LogStream()
+    : m_data(m_inline) {
+}
+
+LogStream::~LogStream() {
+    if (m_data != m_inline) {
+        delete[] m_data;
+    }
+}
+
+char *LogStream::reserve(size_t len) {
+    if (m_capacity - m_size < len) {
+        size_t cap = m_capacity * 2;
+        while (cap - m_size < len) cap *= 2;
+        char *buf = new char[cap];
+        memcpy(buf, m_data, m_size);
+        if (m_data != m_inline) {
+            delete[] m_data;
+        }
+        m_data = buf;
+        m_capacity = cap;
+    }
+    return m_data + m_size;
+}
+
+void LogStream::append(const char *data, size_t len) {
+    memcpy(reserve(len), data, len);
+    m_size += len;
+}
+
+LogStream &LogStream::operator<<(char v) {
+    *reserve(1) = v;
+    ++m_size;
+    return *this;
+}
+
+LogStream &LogStream::operator<<(const char *v) {
+    if (v) {
+        append(v, strlen(v));
+    }
+    return *this;
+}
+
+LogStream &LogStream::operator<<(const std::string &v) {
+    append(v.data(), v.size());
+    return *this;
+}
+
+const size_t LogStream::kInlineFields;
+
+LogStream::Field &LogStream::addField(const char *key, Field::Type type) {
+    Field *f;
+    if (m_fieldCount < kInlineFields) {
+        f = &m_fields[m_fieldCount++];
+    } else {
+        m_moreFields.push_back(Field());
+        f = &m_moreFields.back();
+    }
+    size_t len = strlen(key);
+    f->type = type;
+    f->key = m_fieldText.size();
+    f->keyLength = len;
+    m_fieldText.append(key, len);
+    return *f;
+}
+
+LogStream &LogStream::kvString(const char *key, const char *v, size_t len) {
+    Field &f = addField(key, Field::String);
+    f.str.offset = m_fieldText.size();
+    f.str.length = len;
+    m_fieldText.append(v, len);
+    return *this;
+}
+
+// 从 end 往前写入十进制数字, 返回起始位置
+static char *ConvertUInt(char *end, unsigned long long v) {
+    do {
+        *--end = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    return end;
+}
+
+static void AppendInt(std::string &out, long long v) {
+    char buf[32];
+    char *end = buf + sizeof(buf);
+    char *p = ConvertUInt(end, v < 0 ? 0ULL - (unsigned long long)v : v);
+    if (v < 0) *--p = '-';
+    out.append(p, end - p);
+}
+
+LogStream &LogStream::appendUnsigned(unsigned long long v) {
+    char buf[32];
+    char *p = ConvertUInt(buf + sizeof(buf), v);
+    append(p, buf + sizeof(buf) - p);
+    return *this;
+}
+
+LogStream &LogStream::appendSigned(long long v) {
+    if (v < 0) {
+        *this << '-';
+        return appendUnsigned(0ULL - (unsigned long long)v);
+    }
+    return appendUnsigned(v);
+}
+
+// 浮点数与指针的输出与 std::ostream 默认格式保持一致
+LogStream &LogStream::operator<<(double v) {
+    char *buf = reserve(32);
+    m_size += snprintf(buf, 32, "%g", v);
+    return *this;
+}
+
+LogStream &LogStream::operator<<(long double v) {
+    char *buf = reserve(48);
+    m_size += snprintf(buf, 48, "%Lg", v);
+    return *this;
+}
+
+LogStream &LogStream::operator<<(const void *v) {
+    if (!v) return *this << '0';
+    static const char digits[] = "0123456789abcdef";
+    char buf[32];
+    char *p = buf + sizeof(buf);
+    uintptr_t i = (uintptr_t)v;
+    do {
+        *--p = digits[i % 16];
+        i /= 16;
+    } while (i);
+    *--p = 'x';
+    *--p = '0';
+    append(p, buf + sizeof(buf) - p);
+    return *this;
 }
 
 void LogEvent::format(const char *fmt, ...) {
@@ -68,234 +215,1927 @@ void LogEvent::format(const char *fmt, ...) {
     va_start(al, fmt);
     va_list tmp;
     va_copy(tmp, al);
-    int len = 1 + vsnprintf(nullptr, 0, fmt, tmp);
+    // 先尝试直接写入剩余空间, 不够时按实际长度扩容后重写
+    size_t avail = 256;
+    char *buf = m_ss.reserve(avail);
+    int len = vsnprintf(buf, avail, fmt, tmp);
     va_end(tmp);
+    if (len >= 0 && (size_t)len >= avail) {
+        buf = m_ss.reserve(len + 1);
+        len = vsnprintf(buf, len + 1, fmt, al);
+    }
     if (len > 0) {
-        char *buf = (char *)malloc(len);
-        vsprintf(buf, fmt, al);
-        m_ss << buf;
-        free(buf);
+        m_ss.commit(len);
+    }
+    va_end(al);
+}
+
+LogStream &LogEventWrap::getSS() {
+    return m_event->getSS();
+}
+
+static void AppendDouble(std::string &out, double v, bool json) {
+    if (json && !std::isfinite(v)) {
+        out.append("null");
+        return;
+    }
+    char buf[32];
+    out.append(buf, snprintf(buf, sizeof(buf), "%.15g", v));
+}
+
+static void AppendJsonString(std::string &out, const char *str, size_t len) {
+    static const char *s_hex = "0123456789abcdef";
+    out.push_back('"');
+    for (const char *p = str, *end = str + len; p != end; ++p) {
+        unsigned char c = *p;
+        switch (c) {
+        case '"':
+            out.append("\\\"");
+            break;
+        case '\\':
+            out.append("\\\\");
+            break;
+        case '\n':
+            out.append("\\n");
+            break;
+        case '\r':
+            out.append("\\r");
+            break;
+        case '\t':
+            out.append("\\t");
+            break;
+        default:
+            if (c < 0x20) {
+                char buf[6] = {'\\', 'u', '0', '0', s_hex[c >> 4], s_hex[c & 0xF]};
+                out.append(buf, sizeof(buf));
+            } else {
+                out.push_back(c);
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+// logfmt 的值含空白、'='、'"' 或为空时加引号
+static void AppendLogfmtString(std::string &out, const char *str, size_t len) {
+    bool quote = len == 0;
+    for (size_t i = 0; i < len && !quote; ++i) {
+        unsigned char c = str[i];
+        quote = c <= ' ' || c == '=' || c == '"';
+    }
+    if (quote) {
+        AppendJsonString(out, str, len);
+    } else {
+        out.append(str, len);
+    }
+}
+
+// 按 logfmt(key=value 以空格分隔)或 JSON 对象输出结构化字段
+static void AppendFields(std::string &out, const LogStream &ss, bool json) {
+    const char *text = ss.fieldText();
+    if (json) out.push_back('{');
+    for (size_t i = 0, n = ss.fieldCount(); i < n; ++i) {
+        const LogStream::Field &f = ss.field(i);
+        if (i) out.push_back(json ? ',' : ' ');
+        if (json) {
+            AppendJsonString(out, text + f.key, f.keyLength);
+            out.push_back(':');
+        } else {
+            out.append(text + f.key, f.keyLength);
+            out.push_back('=');
+        }
+        switch (f.type) {
+        case LogStream::Field::Int:
+            AppendInt(out, f.i);
+            break;
+        case LogStream::Field::UInt: {
+            char buf[32];
+            char *p = ConvertUInt(buf + sizeof(buf), f.u);
+            out.append(p, buf + sizeof(buf) - p);
+            break;
+        }
+        case LogStream::Field::Double:
+            AppendDouble(out, f.d, json);
+            break;
+        case LogStream::Field::Bool:
+            out.append(f.b ? "true" : "false");
+            break;
+        case LogStream::Field::String:
+            if (json) {
+                AppendJsonString(out, text + f.str.offset, f.str.length);
+            } else {
+                AppendLogfmtString(out, text + f.str.offset, f.str.length);
+            }
+            break;
+        }
+    }
+    if (json) out.push_back('}');
+}
+
+class MessageFormatItem : public LogFormatter::FormatItem {
+public:
+    MessageFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os.write(event->getContentData(), event->getContentSize());
+    }
+};
+
+// %k 结构化字段, %k{json} 输出 JSON 对象, 默认 logfmt
+class FieldsFormatItem : public LogFormatter::FormatItem {
+public:
+    FieldsFormatItem(const std::string &str = "")
+        : m_json(str == "json") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        std::string str;
+        format(str, event);
+        os << str;
+    }
+    void format(std::string &out, const LogEvent::ptr &event) const {
+        AppendFields(out, event->getSS(), m_json);
+    }
+
+private:
+    bool m_json;
+};
+
+class LevelFormatItem : public LogFormatter::FormatItem {
+public:
+    LevelFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        for (const char *l = LogLevel::ToString(level); *l != '\0'; ++l)
+            os << (char)toupper(*l);
+    }
+};
+
+class ElapseFormatItem : public LogFormatter::FormatItem {
+public:
+    ElapseFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << event->getElapse();
+    }
+};
+
+class NameFormatItem : public LogFormatter::FormatItem {
+public:
+    NameFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << event->getLogger()->getName();
+    }
+};
+
+class ThreadIdFormatItem : public LogFormatter::FormatItem {
+public:
+    ThreadIdFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << event->getThreadId();
+    }
+};
+
+class FiberIdFormatItem : public LogFormatter::FormatItem {
+public:
+    FiberIdFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << event->getFiberId();
+    }
+};
+
+// 时间格式化, 每个线程按秒缓存 strftime 的结果, 同一秒内直接复用
+// 格式中可用 %3f / %6f / %9f (%f 同 %6f) 输出毫秒 / 微秒 / 纳秒, 由纳秒数直接换算
+class DateTimeFormatItem : public LogFormatter::FormatItem {
+public:
+    DateTimeFormatItem(const std::string &format = "%Y-%m-%d %H:%M:%S")
+        : m_id(++s_id) {
+        std::string fmt = format.empty() ? "%Y-%m-%d %H:%M:%S" : format;
+        // 以第一个小数秒占位符将格式拆为前后两段, 分别交给 strftime
+        for (size_t i = 0; i + 1 < fmt.size(); ++i) {
+            if (fmt[i] != '%') continue;
+            if (fmt[i + 1] == '%') {
+                ++i;
+                continue;
+            }
+            size_t n = 1;
+            int digits = 6;
+            if (fmt[i + 1] >= '1' && fmt[i + 1] <= '9' && i + 2 < fmt.size()) {
+                digits = fmt[i + 1] - '0';
+                n = 2;
+            }
+            if (fmt[i + n] == 'f') {
+                m_head = fmt.substr(0, i);
+                m_tail = fmt.substr(i + n + 1);
+                m_digits = digits;
+                return;
+            }
+        }
+        m_head = fmt;
+    }
+
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        std::string str;
+        format(str, event);
+        os << str;
+    }
+
+    void format(std::string &out, const LogEvent::ptr &event) const {
+        struct Cache {
+            uint32_t id = 0;
+            time_t sec = 0;
+            size_t headLen = 0;
+            size_t tailLen = 0;
+            char buf[128];
+        };
+        static thread_local Cache s_cache[4];
+
+        time_t sec = event->getTime();
+        Cache &c = s_cache[m_id % 4];
+        if (c.id != m_id || c.sec != sec) {
+            struct tm tm;
+            localtime_s(&tm, &sec);
+            c.headLen = strftime(c.buf, sizeof(c.buf) / 2, m_head.c_str(), &tm);
+            c.tailLen = m_digits ? strftime(c.buf + c.headLen, sizeof(c.buf) / 2, m_tail.c_str(), &tm) : 0;
+            c.id = m_id;
+            c.sec = sec;
+        }
+        out.append(c.buf, c.headLen);
+        if (m_digits) {
+            char buf[16];
+            uint32_t frac = event->getNanoSec();
+            for (int i = 9; i > m_digits; --i) frac /= 10;
+            for (int i = m_digits - 1; i >= 0; --i) {
+                buf[i] = '0' + frac % 10;
+                frac /= 10;
+            }
+            out.append(buf, m_digits);
+            out.append(c.buf + c.headLen, c.tailLen);
+        }
+    }
+
+private:
+    static std::atomic<uint32_t> s_id;
+    uint32_t m_id;     // 缓存键
+    std::string m_head;
+    std::string m_tail;
+    int m_digits = 0;  // 小数秒位数, 0 表示不输出
+};
+
+std::atomic<uint32_t> DateTimeFormatItem::s_id(0);
+
+class FilenameFormatItem : public LogFormatter::FormatItem {
+public:
+    FilenameFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << event->getFile();
+    }
+};
+
+class LineFormatItem : public LogFormatter::FormatItem {
+public:
+    LineFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << event->getLine();
+    }
+};
+
+class NewLineFormatItem : public LogFormatter::FormatItem {
+public:
+    NewLineFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << '\n';
+    }
+};
+
+class StringFormatItem : public LogFormatter::FormatItem {
+public:
+    StringFormatItem(const std::string &str)
+        : m_string(str) {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << m_string;
+    }
+
+private:
+    std::string m_string;
+};
+
+class TabFormatItem : public LogFormatter::FormatItem {
+public:
+    TabFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override {
+        os << "\t";
+    }
+};
+
+LogEvent::LogEvent(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse,
+                   uint32_t thread_id, uint32_t fiber_id, uint64_t time)
+    : m_file(file), m_line(line), m_elapse(elapse),
+      m_threadId(thread_id), m_fiberId(fiber_id),
+      m_time(time), m_logger(logger), m_level(level) {
+}
+
+LogEvent::ptr LogEvent::Create(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line,
+                               uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time) {
+    static const size_t kPoolSize = 16;
+    static thread_local std::vector<LogEvent::ptr> s_pool;
+    static thread_local size_t s_next = 0;
+
+    // 引用计数为 1 说明只有池本身持有(异步 Appender 等已经用完)
+    for (size_t i = 0; i < s_pool.size(); ++i) {
+        LogEvent::ptr &e = s_pool[(s_next + i) % s_pool.size()];
+        if (e.use_count() == 1) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s_next = (s_next + i + 1) % s_pool.size();
+            e->m_file = file;
+            e->m_line = line;
+            e->m_elapse = elapse;
+            e->m_threadId = thread_id;
+            e->m_fiberId = fiber_id;
+            e->m_time = time;
+            e->m_nsec = 0;
+            e->m_ss.clear();
+            e->m_logger = logger;
+            e->m_level = level;
+            return e;
+        }
+    }
+    LogEvent::ptr e = std::make_shared<LogEvent>(logger, level, file, line, elapse, thread_id, fiber_id, time);
+    if (s_pool.size() < kPoolSize) {
+        if (s_pool.empty()) s_pool.reserve(kPoolSize);
+        e->m_pooled = true;
+        s_pool.push_back(e);
+    }
+    return e;
+}
+
+void LogEvent::Release(const LogEvent::ptr &event) {
+    if (event->m_pooled && event.use_count() == 2) {
+        event->m_logger.reset();
+    }
+}
+
+LogEvent::ptr LogEvent::Create(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line,
+                               uint32_t thread_id, uint32_t fiber_id) {
+    // 同一次单调时钟读数同时得到实时时间与 elapse
+    uint64_t mono = GetMonotonicNS();
+    uint64_t now = MonotonicToRealtimeNS(mono);
+    LogEvent::ptr e = Create(logger, level, file, line, (mono - GetStartNS()) / 1000000, thread_id, fiber_id,
+                             now / 1000000000);
+    e->m_nsec = now % 1000000000;
+    return e;
+}
+
+std::atomic<uint32_t> LogSite::s_generation(1);
+
+bool LogSite::update(const Logger &logger, LogLevel::Level level) {
+    // 先读代数再计算, 计算期间配置变化时缓存的是旧代数, 下次执行会重新计算
+    uint32_t generation = s_generation.load(std::memory_order_acquire);
+    bool enabled = logger.isEnabled(level);
+    if ((uint32_t)level < 8 && logger.getId() < (1u << 28)) {
+        m_state.store((uint64_t)generation << 32 | (logger.getId() << 3 | (uint32_t)level) << 1 | enabled,
+                      std::memory_order_relaxed);
+    }
+    return enabled;
+}
+
+LogSampler::Result LogSampler::rateLimited(uint64_t per_sec) {
+    if (!per_sec) return pass();
+    uint64_t interval = 1000000000ull / per_sec;
+    uint64_t tolerance = interval * (per_sec - 1); // 允许一秒的突发
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+    uint64_t tat = m_tat.load(std::memory_order_relaxed);
+    for (;;) {
+        uint64_t t = std::max(tat, now);
+        if (t - now > tolerance) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return Result{false, 0};
+        }
+        if (m_tat.compare_exchange_weak(tat, t + interval, std::memory_order_relaxed)) {
+            return pass();
+        }
+    }
+}
+
+LogStream &operator<<(LogStream &os, const LogSampler::Result &v) {
+    if (v.suppressed) {
+        os << "[suppressed " << v.suppressed << "] ";
+    }
+    return os;
+}
+
+const size_t LogCounter::kStripes;
+
+LogCounter::LogCounter() {
+    for (auto &i : m_cells) {
+        i.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LogCounter::get() const {
+    uint64_t sum = 0;
+    for (auto &i : m_cells) {
+        sum += i.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+static std::atomic<size_t> s_counter_stripe(0);
+static thread_local size_t t_counter_stripe = s_counter_stripe++ % LogCounter::kStripes;
+
+size_t LogCounter::Stripe() {
+    return t_counter_stripe;
+}
+
+namespace {
+// 耗时分布(HDR 风格的对数-线性分桶): 每个 2 的幂区间再等分为 kSubBuckets 个桶, 相对误差不超过 1/kSubBuckets
+// 每个线程写自己的计数(单写者, 无需原子加), 读取时在 s_latency_mutex 下与已退出线程的计数合并
+enum LatencyKind {
+    kLatencyFormat = 0, // LogFormatter 格式化一条日志
+    kLatencyWrite,      // Logger::log 交给全部 Appender(含格式化)
+    kLatencyKinds
+};
+
+const int kSubBits = 3;
+const size_t kSubBuckets = 1 << kSubBits;
+const size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+size_t LatencyBucket(uint64_t ns) {
+    if (ns < kSubBuckets) return ns;
+    int e = 63 - __builtin_clzll(ns);
+    return (e - kSubBits + 1) * kSubBuckets + ((ns >> (e - kSubBits)) & (kSubBuckets - 1));
+}
+
+// 桶内的最大值
+uint64_t LatencyBucketMax(size_t index) {
+    if (index < kSubBuckets) return index;
+    int shift = index / kSubBuckets - 1;
+    return ((kSubBuckets + index % kSubBuckets + 1) << shift) - 1;
+}
+
+struct LatencyHistogram {
+    uint64_t counts[kBuckets] = {0};
+    uint64_t sum = 0;
+    uint64_t max = 0;
+};
+
+struct ThreadLatency {
+    std::atomic<uint64_t> counts[kLatencyKinds][kBuckets];
+    std::atomic<uint64_t> sum[kLatencyKinds];
+    std::atomic<uint64_t> max[kLatencyKinds];
+
+    ThreadLatency() {
+        for (int k = 0; k < kLatencyKinds; ++k) {
+            for (auto &i : counts[k]) i.store(0, std::memory_order_relaxed);
+            sum[k].store(0, std::memory_order_relaxed);
+            max[k].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void mergeTo(LatencyHistogram *hists) const {
+        for (int k = 0; k < kLatencyKinds; ++k) {
+            for (size_t i = 0; i < kBuckets; ++i) hists[k].counts[i] += counts[k][i].load(std::memory_order_relaxed);
+            hists[k].sum += sum[k].load(std::memory_order_relaxed);
+            hists[k].max = std::max(hists[k].max, max[k].load(std::memory_order_relaxed));
+        }
+    }
+};
+
+// 各线程的计数与已退出线程合并后的计数
+// 其他编译单元的静态初始化中也可能输出日志, 且进程退出时线程局部变量仍可能析构, 因此按需创建且不释放
+struct LatencyRegistry {
+    std::mutex mutex;
+    std::set<ThreadLatency *> threads;
+    LatencyHistogram retired[kLatencyKinds];
+};
+
+LatencyRegistry &GetLatencyRegistry() {
+    static LatencyRegistry *s_registry = new LatencyRegistry;
+    return *s_registry;
+}
+
+struct ThreadLatencyHolder {
+    ThreadLatency *latency = nullptr;
+
+    ThreadLatency *get() {
+        if (!latency) {
+            latency = new ThreadLatency;
+            LatencyRegistry &registry = GetLatencyRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.threads.insert(latency);
+        }
+        return latency;
+    }
+
+    ~ThreadLatencyHolder() {
+        if (!latency) return;
+        LatencyRegistry &registry = GetLatencyRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        latency->mergeTo(registry.retired);
+        registry.threads.erase(latency);
+        delete latency;
+    }
+};
+
+thread_local ThreadLatencyHolder t_latency;
+
+void RecordLatency(LatencyKind kind, uint64_t ns) {
+    ThreadLatency *t = t_latency.get();
+    auto &count = t->counts[kind][LatencyBucket(ns)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    t->sum[kind].store(t->sum[kind].load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > t->max[kind].load(std::memory_order_relaxed)) t->max[kind].store(ns, std::memory_order_relaxed);
+}
+
+nlohmann::json LatencyToJson(const LatencyHistogram &hist) {
+    nlohmann::json j;
+    uint64_t total = 0;
+    for (auto i : hist.counts) total += i;
+    j["count"] = total;
+    if (!total) return j;
+    j["mean"] = hist.sum / total;
+    static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *kNames[] = {"p50", "p90", "p99", "p999"};
+    size_t q = 0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets && q < 4; ++i) {
+        seen += hist.counts[i];
+        while (q < 4 && seen >= (uint64_t)std::ceil(kQuantiles[q] * total)) {
+            j[kNames[q++]] = std::min(LatencyBucketMax(i), hist.max);
+        }
+    }
+    j["max"] = hist.max;
+    return j;
+}
+} // namespace
+
+static std::atomic<uint32_t> s_logger_id(0);
+
+// 保护 Logger 的层级关系(m_parent / m_children)与生效值的推送
+static std::mutex &HierarchyMutex() {
+    static std::mutex *s_mutex = new std::mutex;
+    return *s_mutex;
+}
+
+Logger::Logger(const std::string &name)
+    : m_id(++s_logger_id), m_name(name), m_level(LogLevel::Debug), m_appenders(std::make_shared<AppenderList>()), m_binlogId(0),
+      m_effectiveLevel(LogLevel::Debug), m_effectiveAppenders(m_appenders), m_effectiveVersion(0) {
+    m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+}
+
+Logger::~Logger() {
+    if (m_parent) {
+        std::lock_guard<std::mutex> lock(HierarchyMutex());
+        auto &children = m_parent->m_children;
+        children.erase(std::remove(children.begin(), children.end(), this), children.end());
+    }
+}
+
+void Logger::setLevel(LogLevel::Level val) {
+    {
+        std::lock_guard<std::mutex> lock(HierarchyMutex());
+        m_level.store(val, std::memory_order_relaxed);
+        updateEffective();
+    }
+    LogSite::Invalidate();
+}
+
+Logger::ptr Logger::getParent() const {
+    std::lock_guard<std::mutex> lock(HierarchyMutex());
+    return m_parent;
+}
+
+std::shared_ptr<const Logger::AppenderList> Logger::getAppenders() const {
+    std::lock_guard<std::mutex> lock(HierarchyMutex());
+    return m_appenders;
+}
+
+std::shared_ptr<const Logger::AppenderList> Logger::getEffectiveAppenders() const {
+    std::lock_guard<std::mutex> lock(m_effectiveMutex);
+    return m_effectiveAppenders;
+}
+
+namespace {
+// 每线程缓存的生效 Appender 集合, 4 路组相联, 按 Logger id 选组
+// 每项以所属 Logger 的版本号校验, 只有该 Logger 的集合变化时才失效
+// 只持有弱引用, 不延长 Logger 及其 Appender 的生命周期
+struct AppenderCache {
+    static const size_t kSets = 16;
+    static const size_t kWays = 4;
+    struct Entry {
+        uint32_t id = 0;
+        uint32_t version = 0;
+        std::weak_ptr<const Logger::AppenderList> list;
+    };
+    Entry entries[kSets][kWays];
+    uint8_t next[kSets] = {}; // 各组下一个替换的位置
+};
+thread_local AppenderCache t_appender_cache;
+} // namespace
+
+std::shared_ptr<const Logger::AppenderList> Logger::cachedAppenders() const {
+    // 先读版本再读集合: 读取期间集合变化时缓存的是旧版本, 下次会重新读取
+    uint32_t version = m_effectiveVersion.load(std::memory_order_acquire);
+    size_t set = m_id % AppenderCache::kSets;
+    AppenderCache::Entry *ways = t_appender_cache.entries[set];
+    AppenderCache::Entry *entry = nullptr;
+    for (size_t i = 0; i < AppenderCache::kWays; ++i) {
+        if (ways[i].id == m_id) {
+            entry = &ways[i];
+            break;
+        }
+    }
+    if (entry && entry->version == version) {
+        auto appenders = entry->list.lock();
+        if (appenders) return appenders;
+    }
+    if (!entry) {
+        uint8_t &next = t_appender_cache.next[set];
+        entry = &ways[next];
+        next = (next + 1) % AppenderCache::kWays;
+    }
+    // 未命中时只加本 Logger 的锁
+    auto appenders = getEffectiveAppenders();
+    entry->id = m_id;
+    entry->version = version;
+    entry->list = appenders;
+    return appenders;
+}
+
+void Logger::updateEffective() {
+    LogLevel::Level level = getLevel();
+    auto appenders = m_appenders;
+    if (m_parent) {
+        if (level == LogLevel::Unknow) level = m_parent->getEffectiveLevel();
+        if (appenders->empty()) appenders = m_parent->m_effectiveAppenders;
+    } else if (level == LogLevel::Unknow) {
+        level = LogLevel::Debug;
+    }
+    m_effectiveLevel.store(level, std::memory_order_relaxed);
+    if (appenders != m_effectiveAppenders) {
+        {
+            std::lock_guard<std::mutex> lock(m_effectiveMutex);
+            m_effectiveAppenders = appenders;
+        }
+        m_effectiveVersion.fetch_add(1, std::memory_order_release);
+    }
+    for (auto i : m_children) {
+        i->updateEffective();
+    }
+}
+
+void Logger::setFormatter(const std::string &val) {
+    setFormatter(LogFormatter::ptr(new LogFormatter(val)));
+}
+
+void Logger::setFormatter(LogFormatter::ptr val) {
+    m_formatter = val;
+    if (isBinary()) {
+        // 更新解码时使用的 pattern
+        BinLog::DefineLogger(m_binlogDefine, m_name, m_formatter->getPattern());
+    }
+}
+
+void Logger::setBinary(bool val) {
+    if (val == isBinary()) return;
+    if (val) {
+        m_binlogDefine = BinLog::DefineLogger(m_binlogDefine, m_name, m_formatter->getPattern());
+        m_binlogId = m_binlogDefine;
+    } else {
+        m_binlogId = 0;
+    }
+    LogSite::Invalidate();
+}
+
+bool Logger::isEnabled(LogLevel::Level level) const {
+    if (level < getEffectiveLevel()) return false;
+    // 二进制模式不经过 Appender
+    if (isBinary()) return true;
+    auto appenders = getEffectiveAppenders();
+    for (auto &i : *appenders) {
+        if (level >= i->getLevel()) return true;
+    }
+    return false;
+}
+
+LogFormatter::ptr Logger::getFormatter() const {
+    return m_formatter;
+}
+
+void Logger::addAppender(LogAppender::ptr appender) {
+    if (!appender->getFormatter()) {
+        appender->setFormatter(m_formatter);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::shared_ptr<AppenderList> list(new AppenderList(*m_appenders));
+    list->push_back(appender);
+    {
+        std::lock_guard<std::mutex> hlock(HierarchyMutex());
+        m_appenders = list;
+        updateEffective();
+    }
+    LogSite::Invalidate();
+}
+
+void Logger::delAppender(LogAppender::ptr appender) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::shared_ptr<AppenderList> list(new AppenderList(*m_appenders));
+    for (auto it = list->begin(); it != list->end(); ++it) {
+        if (*it == appender) {
+            list->erase(it);
+            {
+                std::lock_guard<std::mutex> hlock(HierarchyMutex());
+                m_appenders = list;
+                updateEffective();
+            }
+            LogSite::Invalidate();
+            break;
+        }
+    }
+}
+
+void Logger::clearAppender() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    {
+        std::lock_guard<std::mutex> hlock(HierarchyMutex());
+        m_appenders = std::make_shared<AppenderList>();
+        updateEffective();
+    }
+    LogSite::Invalidate();
+}
+
+void Logger::setAppenders(const AppenderList &appenders) {
+    for (auto &i : appenders) {
+        if (!i->getFormatter()) i->setFormatter(m_formatter);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::shared_ptr<const AppenderList> list = std::make_shared<AppenderList>(appenders);
+    {
+        std::lock_guard<std::mutex> hlock(HierarchyMutex());
+        m_appenders = list;
+        updateEffective();
+    }
+    LogSite::Invalidate();
+}
+
+void Logger::log(LogLevel::Level level, const LogEvent::ptr &event) {
+    if (level >= getEffectiveLevel()) {
+        // 事件所属的通常就是本 Logger, 直接借用其引用, 省去 shared_from_this 的计数开销
+        Logger::ptr holder;
+        const Logger::ptr *self = &event->getLogger();
+        if (self->get() != this) {
+            holder = shared_from_this();
+            self = &holder;
+        }
+        // 自身没有 Appender 时已是上级的集合
+        auto appenders = cachedAppenders();
+        uint64_t start = GetMonotonicNS();
+        LogRenderCache cache;
+        for (auto &i : *appenders) {
+            i->dispatch(*self, level, event, cache);
+        }
+        RecordLatency(kLatencyWrite, GetMonotonicNS() - start);
+        if (level <= LogLevel::Fatal) m_events[level].add(1);
+    }
+}
+
+static const size_t kRenderCacheDepth = 4;
+static thread_local std::string t_render_strings[kRenderCacheDepth][LogRenderCache::kEntries + 1];
+static thread_local size_t t_render_depth = 0;
+
+const size_t LogRenderCache::kEntries;
+
+LogRenderCache::LogRenderCache() {
+    if (t_render_depth < kRenderCacheDepth) {
+        m_strings = t_render_strings[t_render_depth];
+    } else {
+        m_own.reset(new std::string[kEntries + 1]);
+        m_strings = m_own.get();
+    }
+    ++t_render_depth;
+}
+
+LogRenderCache::~LogRenderCache() {
+    --t_render_depth;
+}
+
+const std::string &LogRenderCache::render(const LogFormatter::ptr &formatter, const std::shared_ptr<Logger> &logger,
+                                          LogLevel::Level level, const LogEvent::ptr &event) {
+    for (size_t i = 0; i < m_count; ++i) {
+        if (m_formatters[i] == formatter.get()) return m_strings[i];
+    }
+    std::string *str = &m_strings[kEntries];
+    if (m_count < kEntries) {
+        m_formatters[m_count] = formatter.get();
+        str = &m_strings[m_count++];
+    }
+    str->clear();
+    uint64_t start = GetMonotonicNS();
+    formatter->format(*str, logger, level, event);
+    RecordLatency(kLatencyFormat, GetMonotonicNS() - start);
+    return *str;
+}
+
+void Logger::debug(const LogEvent::ptr &event) {
+    log(LogLevel::Debug, event);
+}
+
+void Logger::info(const LogEvent::ptr &event) {
+    log(LogLevel::Info, event);
+}
+
+void Logger::warn(const LogEvent::ptr &event) {
+    log(LogLevel::Warn, event);
+}
+
+void Logger::error(const LogEvent::ptr &event) {
+    log(LogLevel::Error, event);
+}
+
+void Logger::fatal(const LogEvent::ptr &event) {
+    log(LogLevel::Fatal, event);
+}
+
+namespace {
+
+// 带缓冲的写出端共用的后台定时写出线程
+// 线程不退出, 进程结束时直接终止, 与注册表一样不释放
+class LogFlusher {
+public:
+    typedef std::function<void()> Task;
+
+    static LogFlusher &Get() {
+        static LogFlusher *s_flusher = new LogFlusher;
+        return *s_flusher;
+    }
+
+    // 每 interval 毫秒执行一次 task, 返回任务 id
+    uint64_t add(uint64_t interval, const Task &task) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_started) {
+            std::thread(&LogFlusher::run, this).detach();
+            m_started = true;
+        }
+        uint64_t id = ++m_lastId;
+        Entry &entry = m_tasks[id];
+        entry.interval = interval;
+        entry.next = GetCurrentMS() + interval;
+        entry.task = task;
+        m_cond.notify_all();
+        return id;
+    }
+
+    // 移除任务, 任务正在执行时等待其结束, 返回后不会再被调用
+    void remove(uint64_t id) {
+        if (!id) return;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_tasks.erase(id);
+        m_cond.wait(lock, [this, id]() { return m_running != id; });
+    }
+
+private:
+    struct Entry {
+        uint64_t interval;
+        uint64_t next;
+        Task task;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            uint64_t now = GetCurrentMS();
+            uint64_t wake = now + 1000;
+            auto it = m_tasks.begin();
+            for (; it != m_tasks.end(); ++it) {
+                if (it->second.next <= now) break;
+                wake = std::min(wake, it->second.next);
+            }
+            if (it == m_tasks.end()) {
+                m_cond.wait_for(lock, std::chrono::milliseconds(wake - now));
+                continue;
+            }
+            // 解锁执行, 任务内部会加写出端自己的锁
+            it->second.next = now + it->second.interval;
+            Task task = it->second.task;
+            m_running = it->first;
+            lock.unlock();
+            task();
+            lock.lock();
+            m_running = 0;
+            m_cond.notify_all();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::map<uint64_t, Entry> m_tasks;
+    uint64_t m_lastId = 0;
+    uint64_t m_running = 0; // 正在执行的任务 id
+    bool m_started = false;
+};
+
+} // namespace
+
+const size_t LogFileSink::kDefaultBufferSize;
+
+std::string LogFileSink::CanonicalPath(const std::string &filename) {
+    DWORD size = GetFullPathNameA(filename.c_str(), 0, NULL, NULL);
+    if (!size) return filename;
+    std::string path(size, '\0');
+    size = GetFullPathNameA(filename.c_str(), size, &path[0], NULL);
+    path.resize(size);
+    // 路径不区分大小写
+    std::transform(path.begin(), path.end(), path.begin(), ::tolower);
+    return path;
+}
+
+LogFileSink::ptr LogFileSink::Get(const std::string &filename) {
+    // 进程退出时 Appender 仍可能析构, 注册表不释放
+    static std::mutex *s_mutex = new std::mutex;
+    static std::map<std::string, std::weak_ptr<LogFileSink>> *s_sinks = new std::map<std::string, std::weak_ptr<LogFileSink>>;
+    std::string path = CanonicalPath(filename);
+    std::lock_guard<std::mutex> lock(*s_mutex);
+    auto &weak = (*s_sinks)[path];
+    LogFileSink::ptr sink = weak.lock();
+    if (!sink) {
+        sink.reset(new LogFileSink(filename));
+        weak = sink;
+    }
+    return sink;
+}
+
+LogFileSink::LogFileSink(const std::string &filename)
+    : m_filename(filename), m_file(INVALID_HANDLE_VALUE), m_lastFlush(GetCurrentMS()), m_interval(0) {
+    reopen();
+}
+
+LogFileSink::~LogFileSink() {
+    LogFlusher::Get().remove(m_flushTask);
+    flush();
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+}
+
+size_t LogFileSink::append(const std::string &str) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_front.append(str);
+    return m_front.size();
+}
+
+void LogFileSink::flush() {
+    std::lock_guard<std::mutex> wlock(m_writeMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_front.swap(m_back);
+        m_lastFlush.store(GetCurrentMS(), std::memory_order_relaxed);
+    }
+    if (!m_back.empty() && m_file != INVALID_HANDLE_VALUE) {
+        DWORD written = 0;
+        WriteFile(m_file, m_back.data(), m_back.size(), &written, NULL);
+    }
+    m_back.clear();
+}
+
+bool LogFileSink::reopen() {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+    }
+    m_file = CreateFileA(m_filename.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                         NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    return m_file != INVALID_HANDLE_VALUE;
+}
+
+void LogFileSink::setFlushInterval(uint64_t ms) {
+    if (!ms) return;
+    std::lock_guard<std::mutex> lock(m_taskMutex);
+    uint64_t cur = m_interval.load(std::memory_order_relaxed);
+    if (cur && cur <= ms) return;
+    m_interval.store(ms, std::memory_order_relaxed);
+    // 先移除旧任务, 新任务按更短的周期检查
+    LogFlusher::Get().remove(m_flushTask);
+    m_flushTask = LogFlusher::Get().add(ms, [this]() {
+        if (GetCurrentMS() - getLastFlush() >= m_interval.load(std::memory_order_relaxed)) flush();
+    });
+}
+
+void LogFileSink::reserve(size_t size) {
+    std::lock_guard<std::mutex> wlock(m_writeMutex);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (size > m_front.capacity()) m_front.reserve(size);
+    if (size > m_back.capacity()) m_back.reserve(size);
+}
+
+FileLogAppender::FileLogAppender(const std::string &filename)
+    : m_filename(filename), m_sink(LogFileSink::Get(filename)) {
+}
+
+FileLogAppender::~FileLogAppender() {
+    flush();
+}
+
+void FileLogAppender::log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
+    LogRenderCache cache;
+    dispatch(logger, level, event, cache);
+}
+
+void FileLogAppender::dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                               LogRenderCache &cache) {
+    if (level < getLevel()) return;
+    const std::string &str = cache.render(m_formatter, logger, level, event);
+    m_bytes.add(str.size());
+    size_t size = m_sink->append(str);
+    if (size >= (m_policy.bytes ? m_policy.bytes : LogFileSink::kDefaultBufferSize) ||
+        (m_policy.level != LogLevel::Unknow && level >= m_policy.level) ||
+        (m_policy.interval && GetCurrentMS() - m_sink->getLastFlush() >= m_policy.interval)) {
+        m_sink->flush();
+    }
+}
+
+bool FileLogAppender::reopen() {
+    return m_sink->reopen();
+}
+
+void FileLogAppender::flush() {
+    m_sink->flush();
+}
+
+void FileLogAppender::setFlushPolicy(const FlushPolicy &val) {
+    flush();
+    m_policy = val;
+    // 预留余量, 避免追加最后一行时扩容
+    m_sink->reserve(val.bytes + val.bytes / 4);
+    // 间隔由后台线程保证, 没有后续日志时缓冲也会按时写出
+    m_sink->setFlushInterval(val.interval);
+}
+
+const size_t StdoutLogAppender::kBufferSize;
+const uint64_t StdoutLogAppender::kFlushInterval;
+
+StdoutLogAppender::StdoutLogAppender() {
+    Init(m_out, STD_OUTPUT_HANDLE);
+    Init(m_err, STD_ERROR_HANDLE);
+    // 输出为文件或管道时, 没有后续日志也要按时写出缓冲
+    if (!m_out.tty || !m_err.tty) {
+        m_flushTask = LogFlusher::Get().add(kFlushInterval / 10, [this]() {
+            uint64_t now = GetCurrentMS();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (now - m_out.lastFlush >= kFlushInterval) Write(m_out);
+            if (now - m_err.lastFlush >= kFlushInterval) Write(m_err);
+        });
+    }
+}
+
+StdoutLogAppender::~StdoutLogAppender() {
+    LogFlusher::Get().remove(m_flushTask);
+    flush();
+}
+
+void StdoutLogAppender::Init(Stream &stream, DWORD std_handle) {
+    stream.handle = GetStdHandle(std_handle);
+    stream.tty = stream.handle != INVALID_HANDLE_VALUE && stream.handle != NULL &&
+                 GetFileType(stream.handle) == FILE_TYPE_CHAR;
+    stream.buffer.reserve(kBufferSize * 2);
+    stream.lastFlush = GetCurrentMS();
+}
+
+void StdoutLogAppender::Write(Stream &stream) {
+    if (!stream.buffer.empty() && stream.handle != INVALID_HANDLE_VALUE && stream.handle != NULL) {
+        DWORD written = 0;
+        WriteFile(stream.handle, stream.buffer.data(), stream.buffer.size(), &written, NULL);
+    }
+    stream.buffer.clear();
+    stream.lastFlush = GetCurrentMS();
+}
+
+void StdoutLogAppender::log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
+    LogRenderCache cache;
+    dispatch(logger, level, event, cache);
+}
+
+void StdoutLogAppender::dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                                 LogRenderCache &cache) {
+    if (level < getLevel()) return;
+    const std::string &str = cache.render(m_formatter, logger, level, event);
+    m_bytes.add(str.size());
+    Stream &stream = (m_stderrLevel != LogLevel::Unknow && level >= m_stderrLevel) ? m_err : m_out;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stream.buffer.append(str);
+    if ((stream.tty && m_ttyFlush) || level >= LogLevel::Error || stream.buffer.size() >= kBufferSize ||
+        GetCurrentMS() - stream.lastFlush >= kFlushInterval) {
+        Write(stream);
+    }
+}
+
+void StdoutLogAppender::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Write(m_out);
+    Write(m_err);
+}
+
+struct RollingFileLogAppender::Context {
+    Context(const std::string &filename, int max_files)
+        : filename(filename), nextName(filename + ".next"), maxFiles(max_files) {}
+
+    std::string filename;
+    std::string nextName;              // 准备中的文件名, 切换后由后台线程改为 filename
+    int maxFiles;
+    bool stop = false;
+    bool prepare = false;              // 请求准备下一个文件
+    uint64_t prepareSize = 0;          // 预分配字节数
+    HANDLE next = INVALID_HANDLE_VALUE; // 已准备好的文件
+    std::vector<HANDLE> retired;       // 已切换下来, 等待关闭归档的文件
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+const char *LogAppender::OverflowToString(Overflow val) {
+    switch (val) {
+    case DropNewest:
+        return "drop_newest";
+    case DropOldest:
+        return "drop_oldest";
+    case DropBelowLevel:
+        return "drop_below_level";
+    default:
+        return "block";
+    }
+}
+
+LogAppender::Overflow LogAppender::OverflowFromString(const std::string &str) {
+    if (str == "drop_newest") return DropNewest;
+    if (str == "drop_oldest") return DropOldest;
+    if (str == "drop_below_level") return DropBelowLevel;
+    return Block;
+}
+
+const char *RollingFileLogAppender::ModeToString(Mode mode) {
+    switch (mode) {
+    case Hourly:
+        return "hourly";
+    case Daily:
+        return "daily";
+    default:
+        return "size";
+    }
+}
+
+RollingFileLogAppender::Mode RollingFileLogAppender::ModeFromString(const std::string &str) {
+    if (str == "hourly") return Hourly;
+    if (str == "daily") return Daily;
+    return Size;
+}
+
+static const size_t kRollingBufferSize = 8 * 1024;
+
+RollingFileLogAppender::RollingFileLogAppender(const std::string &filename, Mode mode, uint64_t max_size, int max_files)
+    : m_filename(filename), m_mode(mode), m_maxSize(max_size), m_maxFiles(max_files > 0 ? max_files : 0),
+      m_ctx(new Context(filename, m_maxFiles)) {
+    m_handle = CreateFileA(filename.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (m_handle != INVALID_HANDLE_VALUE && GetFileSizeEx(m_handle, &size)) {
+        m_written = size.QuadPart;
+    }
+    m_buffer.reserve(kRollingBufferSize * 2);
+    updateNextRotate(GetRealtimeNS() / 1000000000);
+    m_ctx->prepare = true;
+    m_ctx->prepareSize = m_mode == Size ? m_maxSize : 0;
+    m_thread = std::thread(&RollingFileLogAppender::Run, m_ctx);
+}
+
+RollingFileLogAppender::~RollingFileLogAppender() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        writeBuffer();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_ctx->mutex);
+        m_ctx->stop = true;
+    }
+    m_ctx->cond.notify_one();
+    m_thread.join();
+    if (m_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_handle);
+    }
+}
+
+void RollingFileLogAppender::log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
+    LogRenderCache cache;
+    dispatch(logger, level, event, cache);
+}
+
+void RollingFileLogAppender::dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                                      LogRenderCache &cache) {
+    if (level < getLevel()) return;
+    const std::string &str = cache.render(m_formatter, logger, level, event);
+    m_bytes.add(str.size());
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_written > 0) {
+        bool need = m_mode == Size ? (m_maxSize && m_written + str.size() > m_maxSize)
+                                   : event->getTime() >= m_nextRotate;
+        // 下一个文件尚未准备好时继续写当前文件, 下一条日志再尝试
+        if (need && rotate() && m_mode != Size) {
+            updateNextRotate(event->getTime());
+        }
+    }
+    m_buffer.append(str);
+    m_written += str.size();
+    if (m_buffer.size() >= kRollingBufferSize || level >= LogLevel::Fatal) {
+        writeBuffer();
+    }
+}
+
+void RollingFileLogAppender::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    writeBuffer();
+}
+
+void RollingFileLogAppender::writeBuffer() {
+    if (m_buffer.empty()) return;
+    if (m_handle != INVALID_HANDLE_VALUE) {
+        DWORD written = 0;
+        WriteFile(m_handle, m_buffer.data(), m_buffer.size(), &written, NULL);
+    }
+    m_buffer.clear();
+}
+
+bool RollingFileLogAppender::rotate() {
+    {
+        std::lock_guard<std::mutex> lock(m_ctx->mutex);
+        if (m_ctx->next == INVALID_HANDLE_VALUE) {
+            // 上次创建失败时重新请求
+            if (!m_ctx->prepare) {
+                m_ctx->prepare = true;
+                m_ctx->cond.notify_one();
+            }
+            return false;
+        }
+        writeBuffer();
+        if (m_handle != INVALID_HANDLE_VALUE) {
+            m_ctx->retired.push_back(m_handle);
+        }
+        m_handle = m_ctx->next;
+        m_ctx->next = INVALID_HANDLE_VALUE;
+        m_ctx->prepare = true;
+        // 按时间切换时以上一个文件的大小预估下一个文件
+        m_ctx->prepareSize = m_mode == Size ? m_maxSize : m_written;
+    }
+    m_ctx->cond.notify_one();
+    m_written = 0;
+    return true;
+}
+
+void RollingFileLogAppender::updateNextRotate(uint64_t now) {
+    if (m_mode == Size) return;
+    time_t t = now;
+    struct tm tm;
+    localtime_s(&tm, &t);
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    if (m_mode == Hourly) {
+        tm.tm_hour += 1;
+    } else {
+        tm.tm_hour = 0;
+        tm.tm_mday += 1;
+    }
+    tm.tm_isdst = -1;
+    m_nextRotate = mktime(&tm);
+}
+
+void RollingFileLogAppender::Run(std::shared_ptr<Context> ctx) {
+    std::unique_lock<std::mutex> lock(ctx->mutex);
+    for (;;) {
+        ctx->cond.wait(lock, [&ctx]() { return ctx->stop || ctx->prepare || !ctx->retired.empty(); });
+        std::vector<HANDLE> retired;
+        retired.swap(ctx->retired);
+        bool prepare = ctx->prepare && !ctx->stop;
+        uint64_t prepare_size = ctx->prepareSize;
+        bool stop = ctx->stop;
+        lock.unlock();
+
+        for (auto h : retired) {
+            CloseHandle(h);
+            // 旧文件依次后移: filename.(n-1) -> filename.n ... filename -> filename.1
+            int last = ctx->maxFiles;
+            if (last) {
+                DeleteFileA((ctx->filename + "." + std::to_string(last)).c_str());
+            } else {
+                while (GetFileAttributesA((ctx->filename + "." + std::to_string(last + 1)).c_str()) != INVALID_FILE_ATTRIBUTES) {
+                    ++last;
+                }
+                ++last;
+            }
+            for (int i = last - 1; i >= 1; --i) {
+                MoveFileExA((ctx->filename + "." + std::to_string(i)).c_str(),
+                            (ctx->filename + "." + std::to_string(i + 1)).c_str(), MOVEFILE_REPLACE_EXISTING);
+            }
+            MoveFileExA(ctx->filename.c_str(), (ctx->filename + ".1").c_str(), MOVEFILE_REPLACE_EXISTING);
+            // 正在写入的文件以 FILE_SHARE_DELETE 打开, 可以直接改名
+            MoveFileExA(ctx->nextName.c_str(), ctx->filename.c_str(), MOVEFILE_REPLACE_EXISTING);
+        }
+
+        HANDLE next = INVALID_HANDLE_VALUE;
+        if (prepare) {
+            // 预分配需要 FILE_WRITE_DATA, 仅有 FILE_APPEND_DATA 时会失败;
+            // 新建的空文件只由这一个句柄顺序写入, 文件指针始终在末尾, 与追加写等价
+            next = CreateFileA(ctx->nextName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (next == INVALID_HANDLE_VALUE) {
+                std::cout << "open rolling log file " << ctx->nextName << " failed, error=" << GetLastError() << std::endl;
+            } else if (prepare_size) {
+                // 只分配空间不改变文件长度, 写入时无需同步扩展文件元数据
+                FILE_ALLOCATION_INFO info;
+                info.AllocationSize.QuadPart = prepare_size;
+                if (!SetFileInformationByHandle(next, FileAllocationInfo, &info, sizeof(info))) {
+                    std::cout << "preallocate rolling log file " << ctx->nextName << " failed, error=" << GetLastError()
+                              << std::endl;
+                }
+            }
+        }
+
+        lock.lock();
+        if (prepare) {
+            ctx->next = next;
+            ctx->prepare = false;
+        }
+        if (stop && ctx->retired.empty()) {
+            if (ctx->next != INVALID_HANDLE_VALUE) {
+                CloseHandle(ctx->next);
+                ctx->next = INVALID_HANDLE_VALUE;
+                DeleteFileA(ctx->nextName.c_str());
+            }
+            return;
+        }
+    }
+}
+
+const uint64_t MmapLogAppender::kChunkSize;
+const size_t MmapLogAppender::kChunkSlots;
+const uint64_t MmapLogAppender::kNoChunk;
+
+// 去掉文件尾部的空字节(上次未正常关闭时映射扩展出的部分), 返回有效长度
+static uint64_t TrimTrailingZeros(HANDLE file) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) return 0;
+    uint64_t end = size.QuadPart;
+    char buf[64 * 1024];
+    while (end > 0) {
+        uint64_t begin = end > sizeof(buf) ? end - sizeof(buf) : 0;
+        LARGE_INTEGER pos;
+        pos.QuadPart = begin;
+        DWORD n = 0;
+        if (!SetFilePointerEx(file, pos, NULL, FILE_BEGIN) || !ReadFile(file, buf, end - begin, &n, NULL) || n != end - begin) {
+            break;
+        }
+        while (n > 0 && buf[n - 1] == '\0') --n;
+        if (n > 0) {
+            end = begin + n;
+            break;
+        }
+        end = begin;
+    }
+    if (end != (uint64_t)size.QuadPart) {
+        LARGE_INTEGER pos;
+        pos.QuadPart = end;
+        SetFilePointerEx(file, pos, NULL, FILE_BEGIN);
+        SetEndOfFile(file);
+    }
+    return end;
+}
+
+MmapLogAppender::MmapLogAppender(const std::string &filename)
+    : m_filename(filename), m_cursor(0) {
+    for (auto &i : m_chunks) {
+        i.index.store(kNoChunk, std::memory_order_relaxed);
+        i.base.store(nullptr, std::memory_order_relaxed);
+        i.done.store(0, std::memory_order_relaxed);
+    }
+    m_file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file != INVALID_HANDLE_VALUE) {
+        m_start = TrimTrailingZeros(m_file);
+        m_cursor = m_start;
+    }
+}
+
+MmapLogAppender::~MmapLogAppender() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &i : m_chunks) {
+        if (i.index.load(std::memory_order_relaxed) != kNoChunk) {
+            UnmapViewOfFile(i.base.load(std::memory_order_relaxed));
+        }
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+        // 截断映射时扩展出的未使用部分
+        LARGE_INTEGER pos;
+        pos.QuadPart = m_cursor.load();
+        SetFilePointerEx(m_file, pos, NULL, FILE_BEGIN);
+        SetEndOfFile(m_file);
+        CloseHandle(m_file);
     }
-    va_end(al);
 }
 
-std::stringstream &LogEventWrap::getSS() {
-    return m_event->getSS();
+void MmapLogAppender::log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
+    LogRenderCache cache;
+    dispatch(logger, level, event, cache);
 }
 
-class MessageFormatItem : public LogFormatter::FormatItem {
-public:
-    MessageFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getContent();
-    }
-};
+void MmapLogAppender::dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                               LogRenderCache &cache) {
+    if (level < getLevel() || m_file == INVALID_HANDLE_VALUE) return;
+    const std::string &str = cache.render(m_formatter, logger, level, event);
+    m_bytes.add(str.size());
+    write(m_cursor.fetch_add(str.size(), std::memory_order_relaxed), str.data(), str.size());
+}
 
-class LevelFormatItem : public LogFormatter::FormatItem {
-public:
-    LevelFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        for (const char *l = LogLevel::ToString(level); *l != '\0'; ++l)
-            os << (char)toupper(*l);
+void MmapLogAppender::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &i : m_chunks) {
+        if (i.index.load(std::memory_order_relaxed) != kNoChunk) {
+            FlushViewOfFile(i.base.load(std::memory_order_relaxed), 0);
+        }
     }
-};
+}
 
-class ElapseFormatItem : public LogFormatter::FormatItem {
-public:
-    ElapseFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getElapse();
+void MmapLogAppender::write(uint64_t pos, const char *data, size_t len) {
+    while (len) {
+        uint64_t offset = pos % kChunkSize;
+        size_t n = std::min<uint64_t>(len, kChunkSize - offset);
+        Chunk *chunk = getChunk(pos / kChunkSize);
+        if (chunk) {
+            memcpy(chunk->base.load(std::memory_order_relaxed) + offset, data, n);
+            commit(chunk, n);
+        } else {
+            skip(pos, n);
+        }
+        pos += n;
+        data += n;
+        len -= n;
     }
-};
+}
 
-class NameFormatItem : public LogFormatter::FormatItem {
-public:
-    NameFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLogger()->getName();
+MmapLogAppender::Chunk *MmapLogAppender::getChunk(uint64_t index) {
+    Chunk *chunk = &m_chunks[index % kChunkSlots];
+    // 本线程在该块中有未提交的数据, 块不会在此期间解除映射
+    if (chunk->index.load(std::memory_order_acquire) == index) return chunk;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            uint64_t cur = chunk->index.load(std::memory_order_relaxed);
+            if (cur == index) return chunk;
+            if (cur == kNoChunk) {
+                uint64_t offset = index * kChunkSize;
+                uint64_t end = offset + kChunkSize;
+                if (end > m_mappingSize) {
+                    // 映射对象的大小决定文件长度, 按块扩展; 已映射的视图不受关闭旧映射对象影响
+                    HANDLE mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, end >> 32, end & 0xFFFFFFFF, NULL);
+                    if (!mapping) return nullptr;
+                    if (m_mapping) CloseHandle(m_mapping);
+                    m_mapping = mapping;
+                    m_mappingSize = end;
+                }
+                char *base = (char *)MapViewOfFile(m_mapping, FILE_MAP_WRITE, offset >> 32, offset & 0xFFFFFFFF, kChunkSize);
+                if (!base) return nullptr;
+                // 打开时已有的数据与此前放弃的范围视为已写完
+                uint64_t done = m_start > offset ? std::min(m_start - offset, kChunkSize) : 0;
+                auto it = m_skipped.find(index);
+                if (it != m_skipped.end()) {
+                    for (auto &r : it->second) {
+                        memset(base + r.first, '\n', r.second);
+                        done += r.second;
+                    }
+                    m_skipped.erase(it);
+                }
+                chunk->done.store(done, std::memory_order_relaxed);
+                chunk->base.store(base, std::memory_order_relaxed);
+                chunk->index.store(index, std::memory_order_release);
+                return chunk;
+            }
+        }
+        // 槽位仍被未写完的旧块占用
+        std::this_thread::yield();
     }
-};
+}
 
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadIdFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadId();
+void MmapLogAppender::skip(uint64_t pos, size_t len) {
+    uint64_t index = pos / kChunkSize;
+    Chunk *chunk = &m_chunks[index % kChunkSlots];
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (chunk->index.load(std::memory_order_relaxed) != index) {
+            m_skipped[index].push_back(std::make_pair(pos % kChunkSize, (uint64_t)len));
+            return;
+        }
     }
-};
+    // 其间已被其它线程映射, 本线程未提交的范围保证块不会解除映射
+    memset(chunk->base.load(std::memory_order_relaxed) + pos % kChunkSize, '\n', len);
+    commit(chunk, len);
+}
 
-class FiberIdFormatItem : public LogFormatter::FormatItem {
-public:
-    FiberIdFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFiberId();
+void MmapLogAppender::commit(Chunk *chunk, size_t len) {
+    if (chunk->done.fetch_add(len, std::memory_order_acq_rel) + len == kChunkSize) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        UnmapViewOfFile(chunk->base.load(std::memory_order_relaxed));
+        chunk->base.store(nullptr, std::memory_order_relaxed);
+        chunk->index.store(kNoChunk, std::memory_order_release);
     }
-};
+}
 
-class DateTimeFormatItem : public LogFormatter::FormatItem {
-public:
-    DateTimeFormatItem(const std::string &format = "%Y-%m-%d %H:%M:%S")
-        : m_format(format) {
-        if (m_format.empty()) {
-            m_format = "%Y-%m-%d %H:%M:%S";
+const size_t RingBufferLogAppender::kDefaultSize;
+
+RingBufferLogAppender::RingBufferLogAppender(size_t size, const std::string &dump_file)
+    : m_buffer(std::max<size_t>(size, 4096)), m_dumpFile(dump_file) {
+}
+
+void RingBufferLogAppender::log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
+    LogRenderCache cache;
+    dispatch(logger, level, event, cache);
+}
+
+void RingBufferLogAppender::dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                                     LogRenderCache &cache) {
+    if (level < getLevel()) return;
+    const std::string &str = cache.render(m_formatter, logger, level, event);
+    m_bytes.add(str.size());
+    const std::string &name = logger->getName();
+    Header header;
+    header.nameLen = std::min<size_t>(name.size(), 255);
+    // 超过缓冲大小的单条日志截断
+    size_t len = std::min(str.size(), m_buffer.size() - sizeof(header) - header.nameLen);
+    header.size = sizeof(header) + header.nameLen + len;
+    header.time = event->getTimeNS();
+    header.level = level;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // 覆盖最早的记录
+        while (m_head + header.size - m_tail > m_buffer.size()) {
+            uint32_t size;
+            read(m_tail, &size, sizeof(size));
+            m_tail += size;
         }
+        write(m_head, &header, sizeof(header));
+        write(m_head + sizeof(header), name.data(), header.nameLen);
+        write(m_head + sizeof(header) + header.nameLen, str.data(), len);
+        m_head += header.size;
     }
-
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        time_t time = event->getTime();
-        struct tm *timeinfo = localtime(&time);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), timeinfo);
-        os << buf;
+    if (level >= LogLevel::Fatal && !m_dumpFile.empty()) {
+        dump(m_dumpFile);
     }
+}
 
-private:
-    std::string m_format;
-};
+void RingBufferLogAppender::write(uint64_t pos, const void *data, size_t len) {
+    size_t offset = pos % m_buffer.size();
+    size_t n = std::min(len, m_buffer.size() - offset);
+    memcpy(&m_buffer[offset], data, n);
+    if (n < len) memcpy(&m_buffer[0], (const char *)data + n, len - n);
+}
 
-class FilenameFormatItem : public LogFormatter::FormatItem {
-public:
-    FilenameFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFile();
-    }
-};
+void RingBufferLogAppender::read(uint64_t pos, void *data, size_t len) const {
+    size_t offset = pos % m_buffer.size();
+    size_t n = std::min(len, m_buffer.size() - offset);
+    memcpy(data, &m_buffer[offset], n);
+    if (n < len) memcpy((char *)data + n, &m_buffer[0], len - n);
+}
 
-class LineFormatItem : public LogFormatter::FormatItem {
-public:
-    LineFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLine();
+std::vector<RingBufferLogAppender::Record> RingBufferLogAppender::query(const Filter &filter) const {
+    std::vector<Record> records;
+    std::string prefix = filter.logger + ".";
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint64_t pos = m_tail; pos < m_head;) {
+        Header header;
+        read(pos, &header, sizeof(header));
+        if (header.level >= (uint32_t)filter.level && header.time >= filter.begin && header.time < filter.end) {
+            Record r;
+            r.logger.resize(header.nameLen);
+            read(pos + sizeof(header), &r.logger[0], header.nameLen);
+            if (filter.logger.empty() || r.logger == filter.logger || r.logger.compare(0, prefix.size(), prefix) == 0) {
+                r.level = (LogLevel::Level)header.level;
+                r.time = header.time;
+                r.text.resize(header.size - sizeof(header) - header.nameLen);
+                read(pos + sizeof(header) + header.nameLen, &r.text[0], r.text.size());
+                records.push_back(std::move(r));
+            }
+        }
+        pos += header.size;
     }
-};
+    return records;
+}
 
-class NewLineFormatItem : public LogFormatter::FormatItem {
-public:
-    NewLineFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
+void RingBufferLogAppender::dump(std::ostream &os, const Filter &filter) const {
+    for (auto &i : query(filter)) {
+        os << i.text;
     }
-};
+    os.flush();
+}
 
-class StringFormatItem : public LogFormatter::FormatItem {
-public:
-    StringFormatItem(const std::string &str)
-        : m_string(str) {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << m_string;
-    }
+bool RingBufferLogAppender::dump(const std::string &file, const Filter &filter) const {
+    std::ofstream ofs(file, std::ios::app);
+    if (!ofs) return false;
+    dump(ofs, filter);
+    return (bool)ofs;
+}
 
-private:
-    std::string m_string;
+void RingBufferLogAppender::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_head = m_tail = 0;
+}
+
+static const char kShmMagic[8] = "SYLSHM1";
+static const size_t kShmAlign = 16;
+
+struct ShmLogAppender::Header {
+    char magic[8];
+    uint64_t size;                // 数据区字节数
+    std::atomic<uint64_t> cursor; // 下一条的写入位置(累计字节数)
+    char reserved[40];
 };
 
-class TabFormatItem : public LogFormatter::FormatItem {
-public:
-    TabFormatItem(const std::string &str = "") {}
-    void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << "\t";
-    }
+struct ShmLogAppender::Record {
+    std::atomic<uint64_t> pos; // 记录的写入位置, 内容写完后写入
+    uint32_t size;             // 记录字节数(含记录头与对齐)
+    uint32_t length;           // 文本字节数
 };
 
-LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse,
-                   uint32_t thread_id, uint32_t fiber_id, uint64_t time)
-    : m_file(file), m_line(line), m_elapse(elapse),
-      m_threadId(thread_id), m_fiberId(fiber_id),
-      m_time(time), m_logger(logger), m_level(level) {
+const size_t ShmLogAppender::kDefaultSize;
+
+ShmLogAppender::ShmLogAppender(const std::string &filename, size_t size)
+    : m_filename(filename), m_size(std::max<size_t>(size, 64 * 1024) & ~(kShmAlign - 1)) {
+    static_assert(sizeof(Header) == 64 && sizeof(Record) == kShmAlign, "unexpected shm layout");
+    m_file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE) return;
+    uint64_t total = sizeof(Header) + m_size;
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, total >> 32, total & 0xFFFFFFFF, NULL);
+    if (m_mapping) m_header = (Header *)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, total);
+    if (!m_header) return;
+    if (memcmp(m_header->magic, kShmMagic, sizeof(kShmMagic)) != 0 || m_header->size != m_size) {
+        // 新文件或大小改变时重新初始化; 否则接着上次的游标写, 上次留下的日志作为最早的部分保留
+        memset((char *)(m_header + 1), 0, m_size);
+        m_header->size = m_size;
+        m_header->cursor.store(0);
+        memcpy(m_header->magic, kShmMagic, sizeof(kShmMagic));
+    }
+    m_data = (char *)(m_header + 1);
 }
 
-Logger::Logger(const std::string &name)
-    : m_name(name), m_level(LogLevel::Debug) {
-    m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+ShmLogAppender::~ShmLogAppender() {
+    if (m_header) UnmapViewOfFile(m_header);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
 }
 
-void Logger::setFormatter(const std::string &val) {
-    m_formatter.reset(new LogFormatter(val));
+void ShmLogAppender::log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
+    LogRenderCache cache;
+    dispatch(logger, level, event, cache);
 }
 
-void Logger::setFormatter(LogFormatter::ptr val) {
-    m_formatter = val;
+void ShmLogAppender::dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                              LogRenderCache &cache) {
+    if (level < getLevel() || !m_data) return;
+    const std::string &str = cache.render(m_formatter, logger, level, event);
+    m_bytes.add(str.size());
+    write(str.data(), str.size());
 }
 
-LogFormatter::ptr Logger::getFormatter() const {
-    return m_formatter;
+void ShmLogAppender::flush() {
+    if (m_header) FlushViewOfFile(m_header, 0);
 }
 
-void Logger::addAppender(LogAppender::ptr appender) {
-    if (!appender->getFormatter()) {
-        appender->setFormatter(m_formatter);
+void ShmLogAppender::write(const char *data, size_t len) {
+    // 超过数据区一半的单条日志截断
+    len = std::min(len, m_size / 2 - sizeof(Record));
+    uint32_t size = (sizeof(Record) + len + kShmAlign - 1) & ~(kShmAlign - 1);
+    for (;;) {
+        uint64_t pos = m_header->cursor.fetch_add(size, std::memory_order_relaxed);
+        uint64_t offset = pos % m_size;
+        if (offset + size <= m_size) {
+            put(pos, size, data, len);
+            return;
+        }
+        // 跨过数据区末尾, 两段都写为空记录后重新申请
+        put(pos, m_size - offset, nullptr, 0);
+        put(pos + m_size - offset, offset + size - m_size, nullptr, 0);
     }
-    m_appenders.push_back(appender);
 }
 
-void Logger::delAppender(LogAppender::ptr appender) {
-    for (auto it = m_appenders.begin(); it != m_appenders.end(); ++it) {
-        if (*it == appender) {
-            m_appenders.erase(it);
-            break;
+void ShmLogAppender::put(uint64_t pos, uint32_t size, const char *data, size_t len) {
+    Record *r = (Record *)(m_data + pos % m_size);
+    r->size = size;
+    r->length = len;
+    if (len) memcpy((char *)(r + 1), data, len);
+    r->pos.store(pos, std::memory_order_release);
+}
+
+bool ShmLogAppender::Recover(const std::string &filename, std::ostream &os) {
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs) return false;
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    std::string buf = ss.str();
+    if (buf.size() < sizeof(Header) || memcmp(buf.data(), kShmMagic, sizeof(kShmMagic)) != 0) return false;
+    uint64_t size, cursor;
+    memcpy(&size, buf.data() + offsetof(Header, size), sizeof(size));
+    memcpy(&cursor, buf.data() + offsetof(Header, cursor), sizeof(cursor));
+    if (!size || size % kShmAlign || buf.size() < sizeof(Header) + size) return false;
+
+    // 数据区内 [cursor - size, cursor) 的每个位置都还是该位置最后一次写入的内容
+    const char *data = buf.data() + sizeof(Header);
+    uint64_t pos = cursor > size ? cursor - size : 0;
+    while (pos + sizeof(Record) <= cursor) {
+        const char *r = data + pos % size;
+        uint64_t rpos;
+        uint32_t rsize, length;
+        memcpy(&rpos, r + offsetof(Record, pos), sizeof(rpos));
+        memcpy(&rsize, r + offsetof(Record, size), sizeof(rsize));
+        memcpy(&length, r + offsetof(Record, length), sizeof(length));
+        if (rpos == pos && rsize >= sizeof(Record) && rsize % kShmAlign == 0 && pos % size + rsize <= size &&
+            pos + rsize <= cursor && length <= rsize - sizeof(Record)) {
+            os.write(r + sizeof(Record), length);
+            pos += rsize;
+        } else {
+            // 未写完或已被覆盖, 按对齐逐步找下一条
+            pos += kShmAlign;
         }
     }
+    os.flush();
+    return true;
 }
 
-void Logger::clearAppender() {
-    m_appenders.clear();
+struct AsyncLogAppender::Item {
+    std::shared_ptr<Logger> logger;
+    LogLevel::Level level = LogLevel::Unknow;
+    LogEvent::ptr event;
+};
+
+struct AsyncLogAppender::Context {
+    Context(LogAppender::ptr appender, size_t capacity)
+        : appender(appender), queue(capacity), stop(false), sleeping(false), flushRequest(0), dropped(0), reported(0),
+          lastReport(0) {}
+
+    LogAppender::ptr appender;
+    RingQueue<Item> queue;
+    std::atomic<bool> stop;
+    std::atomic<bool> sleeping;
+    std::atomic<uint64_t> flushRequest; // flush 请求序号
+    std::atomic<uint64_t> dropped;      // 丢弃的条数
+    uint64_t reported;                  // 已写入汇总日志的丢弃条数, 只由后台线程访问
+    uint64_t lastReport;                // 上次写入汇总日志的时间(ms), 只由后台线程访问
+    uint64_t flushDone = 0;             // 已完成的 flush 序号, 受 mutex 保护
+    std::mutex mutex;
+    std::condition_variable cond;      // 唤醒后台线程
+    std::condition_variable flushCond; // 通知 flush 完成
+};
+
+const size_t AsyncLogAppender::kDefaultCapacity;
+const uint64_t AsyncLogAppender::kDropReportInterval;
+
+AsyncLogAppender::AsyncLogAppender(LogAppender::ptr appender, size_t capacity)
+    : m_ctx(new Context(appender, capacity ? capacity : kDefaultCapacity)) {
+    m_thread = std::thread(&AsyncLogAppender::Run, m_ctx);
 }
 
-void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        auto self = shared_from_this();
-        if (!m_appenders.empty()) {
-            for (auto &i : m_appenders) {
-                i->log(self, level, event);
-            }
-        } else if (m_root) {
-            m_root->log(level, event);
-        }
+AsyncLogAppender::~AsyncLogAppender() {
+    m_ctx->stop = true;
+    Wakeup(*m_ctx);
+    if (m_thread.get_id() == std::this_thread::get_id()) {
+        // 由后台线程释放了最后的引用, 剩余日志由它继续写完
+        m_thread.detach();
+    } else {
+        m_thread.join();
     }
 }
 
-void Logger::debug(LogEvent::ptr event) {
-    log(LogLevel::Debug, event);
+LogAppender::ptr AsyncLogAppender::getAppender() const {
+    return m_ctx->appender;
 }
 
-void Logger::info(LogEvent::ptr event) {
-    log(LogLevel::Info, event);
+size_t AsyncLogAppender::getCapacity() const {
+    return m_ctx->queue.capacity();
 }
 
-void Logger::warn(LogEvent::ptr event) {
-    log(LogLevel::Warn, event);
+uint64_t AsyncLogAppender::getDropped() const {
+    return m_ctx->dropped.load(std::memory_order_relaxed);
 }
 
-void Logger::error(LogEvent::ptr event) {
-    log(LogLevel::Error, event);
+void AsyncLogAppender::ReportDropped(Context &ctx, const std::shared_ptr<Logger> &logger) {
+    uint64_t dropped = ctx.dropped.load(std::memory_order_relaxed);
+    if (dropped == ctx.reported || !logger) return;
+    uint64_t now = GetCurrentMS();
+    if (now < ctx.lastReport + kDropReportInterval) return;
+    LogEvent::ptr event = LogEvent::Create(logger, LogLevel::Warn, __FILE__, __LINE__, GetThreadId(), GetFiberId());
+    event->getSS() << "async appender dropped " << dropped - ctx.reported << " log events, total " << dropped;
+    ctx.appender->log(logger, LogLevel::Warn, event);
+    LogEvent::Release(event);
+    ctx.reported = dropped;
+    ctx.lastReport = now;
 }
 
-void Logger::fatal(LogEvent::ptr event) {
-    log(LogLevel::Fatal, event);
+void AsyncLogAppender::log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
+    if (level < getLevel()) return;
+    Context &ctx = *m_ctx;
+    Item item;
+    item.logger = logger;
+    item.level = level;
+    item.event = event;
+    Overflow overflow = level >= LogLevel::Fatal ? Block : m_overflow;
+    while (!ctx.queue.push(std::move(item))) {
+        if (overflow == DropNewest || (overflow == DropBelowLevel && level < m_dropLevel)) {
+            ctx.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (overflow == DropOldest) {
+            Item oldest;
+            if (ctx.queue.pop(oldest)) {
+                if (oldest.level < LogLevel::Error) {
+                    ctx.dropped.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                // Error / Fatal 不丢弃: 放回队尾, 本条改为阻塞等待, 避免在全是 Error 的队列上反复轮转
+                while (!ctx.queue.push(std::move(oldest))) {
+                    Wakeup(ctx);
+                    std::this_thread::yield();
+                }
+                overflow = Block;
+            }
+            continue;
+        }
+        // 队列已满, 让出 CPU 等待后台线程腾出空间
+        Wakeup(ctx);
+        std::this_thread::yield();
+    }
+    if (level >= LogLevel::Fatal) {
+        flush();
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_ctx->sleeping.load(std::memory_order_relaxed)) {
+        Wakeup(*m_ctx);
+    }
 }
 
-FileLogAppender::FileLogAppender(const std::string &filename)
-    : m_filename(filename) {
-    reopen();
+void AsyncLogAppender::flush() {
+    Context &ctx = *m_ctx;
+    std::unique_lock<std::mutex> lock(ctx.mutex);
+    uint64_t request = ctx.flushRequest.fetch_add(1) + 1;
+    ctx.cond.notify_one();
+    ctx.flushCond.wait(lock, [&ctx, request]() { return ctx.flushDone >= request; });
 }
 
-void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        m_filestream << m_formatter->format(logger, level, event);
+void AsyncLogAppender::setFormatter(LogFormatter::ptr val) {
+    m_formatter = val;
+    if (!m_ctx->appender->getFormatter()) {
+        m_ctx->appender->setFormatter(val);
     }
 }
 
-bool FileLogAppender::reopen() {
-    if (m_filestream) {
-        m_filestream.close();
-    }
-    m_filestream.open(m_filename, std::ios::app);
-    return !!m_filestream;
+void AsyncLogAppender::Wakeup(Context &ctx) {
+    std::lock_guard<std::mutex> lock(ctx.mutex);
+    ctx.cond.notify_one();
 }
 
-void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        std::cout << m_formatter->format(logger, level, event);
+void AsyncLogAppender::Run(std::shared_ptr<Context> ctx) {
+    Item item;
+    // 最近写出的 Logger, 用于丢弃汇总日志, 不延长其生命周期
+    std::weak_ptr<Logger> last;
+    Logger *lastRaw = nullptr;
+    for (;;) {
+        // 先取 flush 序号再清空队列, 保证序号之前放入的日志都已写出
+        uint64_t request = ctx->flushRequest.load();
+        size_t n = 0;
+        while (ctx->queue.pop(item)) {
+            ctx->appender->log(item.logger, item.level, item.event);
+            if (item.logger.get() != lastRaw) {
+                last = item.logger;
+                lastRaw = item.logger.get();
+            }
+            LogEvent::Release(item.event);
+            item = Item();
+            ++n;
+        }
+        // 队列空闲时也会每 100ms 醒来一次, 汇总不依赖后续的 log 调用
+        if (ctx->dropped.load(std::memory_order_relaxed) != ctx->reported) {
+            ReportDropped(*ctx, last.lock());
+            ++n;
+        }
+        if (n > 0 || request != ctx->flushDone) {
+            ctx->appender->flush();
+        }
+
+        std::unique_lock<std::mutex> lock(ctx->mutex);
+        if (request != ctx->flushDone) {
+            ctx->flushDone = request;
+            ctx->flushCond.notify_all();
+        }
+        if (ctx->stop) {
+            if (ctx->queue.size() == 0) break;
+            continue;
+        }
+        ctx->sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ctx->queue.size() == 0 && ctx->flushRequest.load() == request) {
+            ctx->cond.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        ctx->sleeping = false;
     }
 }
 
@@ -304,12 +2144,95 @@ LogFormatter::LogFormatter(const std::string &pattern)
     init();
 }
 
-std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
+std::string LogFormatter::format(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
+    std::string str;
+    format(str, logger, level, event);
+    return str;
+}
+
+std::ostream &LogFormatter::format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) {
     for (auto &i : m_items) {
-        i->format(ss, logger, level, event);
+        i->format(os, logger, level, event);
+    }
+    return os;
+}
+
+namespace {
+// 格式指令
+enum FormatOp {
+    kOpLiteral = 0,
+    kOpMessage,
+    kOpLevel,
+    kOpElapse,
+    kOpName,
+    kOpThreadId,
+    kOpFiberId,
+    kOpDateTime,
+    kOpFilename,
+    kOpLine,
+    kOpNewLine,
+    kOpTab,
+    kOpFields
+};
+} // namespace
+
+void LogFormatter::format(std::string &out, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) const {
+    static const char *s_levels[] = {"UNKNOW", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+    const char *literals = m_literals.data();
+    for (const Op *op = m_ops.data(), *end = op + m_ops.size(); op != end; ++op) {
+        switch (op->code) {
+        case kOpLiteral:
+            out.append(literals + op->offset, op->length);
+            break;
+        case kOpMessage:
+            out.append(event->getContentData(), event->getContentSize());
+            break;
+        case kOpLevel:
+            out.append(level >= LogLevel::Unknow && level <= LogLevel::Fatal ? s_levels[level] : s_levels[0]);
+            break;
+        case kOpElapse:
+            AppendInt(out, event->getElapse());
+            break;
+        case kOpName:
+            out.append(event->getLogger()->getName());
+            break;
+        case kOpThreadId:
+            AppendInt(out, event->getThreadId());
+            break;
+        case kOpFiberId:
+            AppendInt(out, event->getFiberId());
+            break;
+        case kOpDateTime:
+            static_cast<const DateTimeFormatItem *>(m_items[op->offset].get())->format(out, event);
+            break;
+        case kOpFilename:
+            out.append(event->getFile());
+            break;
+        case kOpLine:
+            AppendInt(out, event->getLine());
+            break;
+        case kOpNewLine:
+            out.push_back('\n');
+            break;
+        case kOpTab:
+            out.push_back('\t');
+            break;
+        case kOpFields:
+            static_cast<const FieldsFormatItem *>(m_items[op->offset].get())->format(out, event);
+            break;
+        }
     }
-    return ss.str();
+}
+
+void LogFormatter::addLiteral(const std::string &str) {
+    // 相邻字面量合并为一条指令
+    if (!m_ops.empty() && m_ops.back().code == kOpLiteral &&
+        m_ops.back().offset + m_ops.back().length == m_literals.size()) {
+        m_ops.back().length += str.size();
+    } else {
+        m_ops.push_back(Op{kOpLiteral, (uint32_t)m_literals.size(), (uint32_t)str.size()});
+    }
+    m_literals.append(str);
 }
 
 void LogFormatter::init() {
@@ -379,36 +2302,42 @@ void LogFormatter::init() {
         vec.push_back(std::make_tuple(nstr, "", 0));
     }
 
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string &str)>> s_format_items = {
-#define XX(str, C) \
+    static std::map<std::string, std::pair<uint32_t, std::function<FormatItem::ptr(const std::string &str)>>> s_format_items = {
+#define XX(str, op, C) \
     { \
-#str, [](const std::string &fmt) { return FormatItem::ptr(new C(fmt)); } \
-    }
-
-        XX(m, MessageFormatItem),
-        XX(p, LevelFormatItem),
-        XX(r, ElapseFormatItem),
-        XX(c, NameFormatItem),
-        XX(t, ThreadIdFormatItem),
-        XX(n, NewLineFormatItem),
-        XX(d, DateTimeFormatItem),
-        XX(f, FilenameFormatItem),
-        XX(l, LineFormatItem),
-        XX(T, TabFormatItem),
-        XX(F, FiberIdFormatItem)
+#str, { op, [](const std::string &fmt) { return FormatItem::ptr(new C(fmt)); } } \
+    }
+
+        XX(m, kOpMessage, MessageFormatItem),
+        XX(p, kOpLevel, LevelFormatItem),
+        XX(r, kOpElapse, ElapseFormatItem),
+        XX(c, kOpName, NameFormatItem),
+        XX(t, kOpThreadId, ThreadIdFormatItem),
+        XX(n, kOpNewLine, NewLineFormatItem),
+        XX(d, kOpDateTime, DateTimeFormatItem),
+        XX(f, kOpFilename, FilenameFormatItem),
+        XX(l, kOpLine, LineFormatItem),
+        XX(T, kOpTab, TabFormatItem),
+        XX(F, kOpFiberId, FiberIdFormatItem),
+        XX(k, kOpFields, FieldsFormatItem)
 #undef XX
     };
 
     for (auto &i : vec) {
         if (std::get<2>(i) == 0) {
             m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+            addLiteral(std::get<0>(i));
         } else {
             auto it = s_format_items.find(std::get<0>(i));
             if (it == s_format_items.end()) {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
+                std::string str = "<<error_format %" + std::get<0>(i) + ">>";
+                m_items.push_back(FormatItem::ptr(new StringFormatItem(str)));
+                addLiteral(str);
                 m_error = true;
             } else {
-                m_items.push_back(it->second(std::get<1>(i)));
+                // 带状态的指令(如 %d %k)以 offset 引用对应的 FormatItem
+                m_ops.push_back(Op{it->second.first, (uint32_t)m_items.size(), 0});
+                m_items.push_back(it->second.second(std::get<1>(i)));
             }
         }
 
@@ -416,35 +2345,122 @@ void LogFormatter::init() {
     }
 }
 
-LogManager::LogManager() {
+LogManager::LogManager() : m_version(0) {
     m_root.reset(new Logger);
     m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
-    m_loggers["root"] = m_root;
+    std::shared_ptr<LoggerMap> loggers(new LoggerMap);
+    (*loggers)["root"] = m_root;
+    m_loggers = loggers;
     init();
 }
 
-std::shared_ptr<LogManager> LogManager::GetInstance() {
+const std::shared_ptr<LogManager> &LogManager::GetInstance() {
     static std::shared_ptr<LogManager> self(new LogManager);
     return self;
 }
 
+namespace {
+// 每线程缓存的 Logger 表快照, 以 LogManager 的版本号校验
+struct LoggerMapCache {
+    const void *owner = nullptr;
+    uint64_t version = 0;
+    std::shared_ptr<const std::map<std::string, Logger::ptr>> loggers;
+};
+thread_local LoggerMapCache t_logger_map_cache;
+} // namespace
+
+std::shared_ptr<const LogManager::LoggerMap> LogManager::snapshot() const {
+    // 先读版本号再读表: 读取期间有新 Logger 时缓存的是旧版本号, 下次会重新读取
+    uint64_t version = m_version.load(std::memory_order_acquire);
+    LoggerMapCache &cache = t_logger_map_cache;
+    if (cache.owner != this || cache.version != version || !cache.loggers) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        cache.loggers = m_loggers;
+        cache.owner = this;
+        cache.version = version;
+    }
+    return cache.loggers;
+}
+
 Logger::ptr LogManager::getLogger(const std::string &name) {
-    auto it = m_loggers.find(name);
-    if (it != m_loggers.end()) return it->second;
+    {
+        // 只读引用缓存中的表, 查找期间不会被替换
+        const LoggerMap &loggers = *snapshot();
+        auto it = loggers.find(name);
+        if (it != loggers.end()) return it->second;
+    }
+
+    std::lock_guard<std::mutex> mlock(m_mutex);
+    // 加锁后重新查找, 其它线程可能已经创建
+    auto loggers = m_loggers;
+    auto it = loggers->find(name);
+    if (it != loggers->end()) return it->second;
     Logger::ptr logger(new Logger(name));
-    logger->m_root = m_root;
-    m_loggers[name] = logger;
+    // 未配置级别时继承上级
+    logger->m_level.store(LogLevel::Unknow, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(HierarchyMutex());
+    // 上级为已存在的最近一级祖先, a.b.c -> a.b -> a -> root
+    Logger::ptr parent = m_root;
+    for (size_t pos = name.rfind('.'); pos != std::string::npos && pos > 0; pos = name.rfind('.', pos - 1)) {
+        auto pit = loggers->find(name.substr(0, pos));
+        if (pit != loggers->end()) {
+            parent = pit->second;
+            break;
+        }
+    }
+    // 先于本 Logger 创建的后代原先挂在 parent 下, 改挂到本 Logger
+    std::string prefix = name + ".";
+    auto &siblings = parent->m_children;
+    for (auto cit = siblings.begin(); cit != siblings.end();) {
+        if ((*cit)->m_name.compare(0, prefix.size(), prefix) == 0) {
+            (*cit)->m_parent = logger;
+            logger->m_children.push_back(*cit);
+            cit = siblings.erase(cit);
+        } else {
+            ++cit;
+        }
+    }
+    logger->m_parent = parent;
+    parent->m_children.push_back(logger.get());
+    logger->updateEffective();
+    std::shared_ptr<LoggerMap> list(new LoggerMap(*loggers));
+    (*list)[name] = logger;
+    m_loggers = list;
+    m_version.fetch_add(1, std::memory_order_release);
     return logger;
 }
 
 struct LogAppenderDefine {
-    int type = 2; // 1 File 2 Stdout
+    int type = 2; // 1 File 2 Stdout 3 Async 4 RollingFile 5 Mmap 6 RingBuffer 7 Shm
     LogLevel::Level level = LogLevel::Unknow;
     std::string formatter;
     std::string file;
+    int capacity = 0; // Async 队列容量, 0 为默认值
+    // File 缓冲写出策略, 见 FileLogAppender::FlushPolicy
+    int flush_bytes = 0;
+    int flush_interval = 0;
+    LogLevel::Level flush_level = LogLevel::Unknow;
+    // RollingFile 切换方式 size/hourly/daily, 按大小切换的字节数, 保留的旧文件数
+    std::string rolling;
+    int64_t max_size = 0;
+    int max_files = 0;
+    // Stdout 不低于该级别写到 stderr, 输出为控制台时是否每行写出
+    LogLevel::Level stderr_level = LogLevel::Unknow;
+    bool tty_flush = true;
+    // RingBuffer / Shm 缓冲字节数, 0 为默认值; RingBuffer 的 file 为 Fatal 时的导出文件
+    int64_t ring_size = 0;
+    // 队列满时的处理 block/drop_newest/drop_oldest/drop_below_level, 见 LogAppender::Overflow
+    std::string overflow;
+    LogLevel::Level drop_level = LogLevel::Unknow;
 
     bool operator==(const LogAppenderDefine &oth) const {
-        return type == oth.type && level == oth.level && formatter == oth.formatter && file == oth.file;
+        return type == oth.type && level == oth.level && formatter == oth.formatter && file == oth.file &&
+               capacity == oth.capacity && flush_bytes == oth.flush_bytes &&
+               flush_interval == oth.flush_interval && flush_level == oth.flush_level &&
+               rolling == oth.rolling && max_size == oth.max_size && max_files == oth.max_files &&
+               stderr_level == oth.stderr_level && tty_flush == oth.tty_flush &&
+               ring_size == oth.ring_size && overflow == oth.overflow && drop_level == oth.drop_level;
     }
 };
 
@@ -452,26 +2468,67 @@ struct LogDefine {
     std::string name;
     LogLevel::Level level = LogLevel::Unknow;
     std::string formatter;
+    bool binary = false;
+    // 覆盖采样/限流宏的参数, 见 Logger::setEveryN
+    int every_n = 0;
+    int first_n = 0;
+    int rate_limit = 0;
     std::vector<LogAppenderDefine> appenders;
 
     bool operator==(const LogDefine &oth) const {
-        return name == oth.name && level == oth.level && formatter == oth.formatter && appenders == oth.appenders;
+        return name == oth.name && level == oth.level && formatter == oth.formatter && binary == oth.binary &&
+               every_n == oth.every_n && first_n == oth.first_n && rate_limit == oth.rate_limit && appenders == oth.appenders;
     }
     bool operator<(const LogDefine &oth) const {
         return name < oth.name;
     }
 };
 
+static const char *AppenderTypeToString(int type) {
+    switch (type) {
+    case 1:
+        return "FileLogAppender";
+    case 3:
+        return "AsyncLogAppender";
+    case 4:
+        return "RollingFileLogAppender";
+    case 5:
+        return "MmapLogAppender";
+    case 6:
+        return "RingBufferLogAppender";
+    case 7:
+        return "ShmLogAppender";
+    default:
+        return "StdoutLogAppender";
+    }
+}
+
 void to_json(nlohmann::json &j, const LogAppenderDefine &v) {
-    j["type"] = v.type == 1 ? "FileLogAppender" : "StdoutLogAppender";
+    j["type"] = AppenderTypeToString(v.type);
     if (v.level != LogLevel::Unknow) j["level"] = v.level;
     if (!v.formatter.empty()) j["formatter"] = v.formatter;
     if (!v.file.empty()) j["file"] = v.file;
+    if (v.capacity) j["capacity"] = v.capacity;
+    if (v.flush_bytes) j["flush_bytes"] = v.flush_bytes;
+    if (v.flush_interval) j["flush_interval"] = v.flush_interval;
+    if (v.flush_level != LogLevel::Unknow) j["flush_level"] = v.flush_level;
+    if (!v.rolling.empty()) j["rolling"] = v.rolling;
+    if (v.max_size) j["max_size"] = v.max_size;
+    if (v.max_files) j["max_files"] = v.max_files;
+    if (v.stderr_level != LogLevel::Unknow) j["stderr_level"] = v.stderr_level;
+    if (!v.tty_flush) j["tty_flush"] = v.tty_flush;
+    if (v.ring_size) j["ring_size"] = v.ring_size;
+    if (!v.overflow.empty()) j["overflow"] = v.overflow;
+    if (v.drop_level != LogLevel::Unknow) j["drop_level"] = v.drop_level;
 }
 void to_json(nlohmann::json &j, const LogDefine &v) {
     j["name"] = v.name;
     if (v.level != LogLevel::Unknow) j["level"] = v.level;
     if (!v.formatter.empty()) j["formatter"] = v.formatter;
+    if (v.binary) j["binary"] = v.binary;
+    if (v.every_n) j["every_n"] = v.every_n;
+    if (v.first_n) j["first_n"] = v.first_n;
+    if (v.rate_limit) j["rate_limit"] = v.rate_limit;
     if (!v.appenders.empty()) j["appenders"] = v.appenders;
 }
 
@@ -491,18 +2548,44 @@ void from_json(const nlohmann::json &j, LogAppenderDefine &v) {
                 v.type = 1;
             else if (str == "StdoutLogAppender")
                 v.type = 2;
+            else if (str == "AsyncLogAppender")
+                v.type = 3;
+            else if (str == "RollingFileLogAppender")
+                v.type = 4;
+            else if (str == "MmapLogAppender")
+                v.type = 5;
+            else if (str == "RingBufferLogAppender")
+                v.type = 6;
+            else if (str == "ShmLogAppender")
+                v.type = 7;
         } else
             SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "config exception: Appender type should be string";
     }
     XX(j, v, level, is_string, Appender);
     XX(j, v, formatter, is_string, Appender);
     XX(j, v, file, is_string, Appender);
+    XX(j, v, capacity, is_number_integer, Appender);
+    XX(j, v, flush_bytes, is_number_integer, Appender);
+    XX(j, v, flush_interval, is_number_integer, Appender);
+    XX(j, v, flush_level, is_string, Appender);
+    XX(j, v, rolling, is_string, Appender);
+    XX(j, v, max_size, is_number_integer, Appender);
+    XX(j, v, max_files, is_number_integer, Appender);
+    XX(j, v, stderr_level, is_string, Appender);
+    XX(j, v, tty_flush, is_boolean, Appender);
+    XX(j, v, ring_size, is_number_integer, Appender);
+    XX(j, v, overflow, is_string, Appender);
+    XX(j, v, drop_level, is_string, Appender);
 }
 
 void from_json(const nlohmann::json &j, LogDefine &v) {
     XX(j, v, name, is_string, Logs);
     XX(j, v, level, is_string, Logs);
     XX(j, v, formatter, is_string, Logs);
+    XX(j, v, binary, is_boolean, Logs);
+    XX(j, v, every_n, is_number_integer, Logs);
+    XX(j, v, first_n, is_number_integer, Logs);
+    XX(j, v, rate_limit, is_number_integer, Logs);
     XX(j, v, appenders, is_array, Logs);
 }
 
@@ -511,43 +2594,186 @@ void from_json(const nlohmann::json &j, LogDefine &v) {
 sylar::ConfigVar<std::set<LogDefine>>::ptr g_log_defines =
     sylar::Config::Lookup("logs", std::set<LogDefine>(), "logs config");
 
+// 二进制日志文件, 为空时不写出
+sylar::ConfigVar<std::string>::ptr g_binlog_file =
+    sylar::Config::Lookup("binlog", std::string(), "binary log file");
+
+static LogAppender::ptr NewFileAppender(const LogAppenderDefine &a) {
+    FileLogAppender::ptr ap(new FileLogAppender(a.file));
+    if (a.flush_bytes > 0) {
+        FileLogAppender::FlushPolicy policy;
+        policy.bytes = a.flush_bytes;
+        policy.interval = a.flush_interval > 0 ? a.flush_interval : 0;
+        policy.level = a.flush_level;
+        ap->setFlushPolicy(policy);
+    }
+    return ap;
+}
+
+static LogAppender::ptr NewStdoutAppender(const LogAppenderDefine &a) {
+    StdoutLogAppender::ptr ap(new StdoutLogAppender);
+    ap->setStderrLevel(a.stderr_level);
+    ap->setTtyFlush(a.tty_flush);
+    return ap;
+}
+
+static void StdoutAppenderToDefine(const StdoutLogAppender::ptr &ap, LogAppenderDefine &lad) {
+    lad.stderr_level = ap->getStderrLevel();
+    lad.tty_flush = ap->getTtyFlush();
+}
+
+static LogAppender::ptr NewRollingFileAppender(const LogAppenderDefine &a) {
+    return LogAppender::ptr(new RollingFileLogAppender(a.file, RollingFileLogAppender::ModeFromString(a.rolling),
+                                                       a.max_size > 0 ? a.max_size : 0, a.max_files));
+}
+
+static void RollingFileAppenderToDefine(const RollingFileLogAppender::ptr &ap, LogAppenderDefine &lad) {
+    lad.file = ap->getFileName();
+    lad.rolling = RollingFileLogAppender::ModeToString(ap->getMode());
+    lad.max_size = ap->getMaxSize();
+    lad.max_files = ap->getMaxFiles();
+}
+
+static void FileAppenderToDefine(const FileLogAppender::ptr &ap, LogAppenderDefine &lad) {
+    lad.file = ap->getFileName();
+    auto &policy = ap->getFlushPolicy();
+    lad.flush_bytes = policy.bytes;
+    lad.flush_interval = policy.interval;
+    lad.flush_level = policy.level;
+}
+
+static LogAppender::ptr NewAppender(const LogAppenderDefine &a, const std::string &logger_name) {
+    sylar::LogAppender::ptr ap;
+    if (a.type == 1)
+        ap = NewFileAppender(a);
+    else if (a.type == 2)
+        ap = NewStdoutAppender(a);
+    else if (a.type == 3) {
+        // 有 file 时包装 FileLogAppender(设置了 rolling 时为 RollingFileLogAppender), 否则包装 StdoutLogAppender
+        sylar::LogAppender::ptr inner;
+        if (!a.file.empty() && !a.rolling.empty())
+            inner = NewRollingFileAppender(a);
+        else if (!a.file.empty())
+            inner = NewFileAppender(a);
+        else
+            inner = NewStdoutAppender(a);
+        ap.reset(new sylar::AsyncLogAppender(inner, a.capacity));
+    } else if (a.type == 4)
+        ap = NewRollingFileAppender(a);
+    else if (a.type == 5)
+        ap.reset(new sylar::MmapLogAppender(a.file));
+    else if (a.type == 6)
+        ap.reset(new sylar::RingBufferLogAppender(a.ring_size > 0 ? a.ring_size : RingBufferLogAppender::kDefaultSize, a.file));
+    else if (a.type == 7)
+        ap.reset(new sylar::ShmLogAppender(a.file, a.ring_size > 0 ? a.ring_size : ShmLogAppender::kDefaultSize));
+    ap->setLevel(a.level);
+    if (a.type == 3) {
+        ap->setOverflow(LogAppender::OverflowFromString(a.overflow),
+                        a.drop_level != LogLevel::Unknow ? a.drop_level : LogLevel::Warn);
+    } else if (!a.overflow.empty() || a.drop_level != LogLevel::Unknow) {
+        // 只有异步 Appender 有队列可以丢弃
+        std::cout << "logger name=" << logger_name << " appender type=" << a.type
+                  << " overflow/drop_level only apply to async appender(type=3), ignored" << std::endl;
+    }
+    if (!a.formatter.empty()) {
+        LogFormatter::ptr fmt(new LogFormatter(a.formatter));
+        if (!fmt->is_Error()) {
+            ap->setHasFormatter(fmt);
+        } else {
+            std::cout << "logger name=" << logger_name << " formatter=" << a.formatter << " is invalid" << std::endl;
+        }
+    }
+    return ap;
+}
+
+// 由配置创建的 Appender, 重新加载时定义与生效格式都不变的直接保留, 不重新打开文件
+struct ConfigAppender {
+    LogAppenderDefine define;
+    std::string pattern; // 生效的格式, 未单独设置时为 Logger 的格式
+    LogAppender::ptr appender;
+};
+typedef std::map<std::string, std::vector<ConfigAppender>> ConfigAppenderMap;
+
+// 写文件的 Appender 在不同 Logger 间定义相同时共用一个实例, 共享打开的文件与缓冲
+static bool IsSharedAppender(const LogAppenderDefine &a) {
+    return !a.file.empty() && a.type != 6;
+}
+
+static LogAppender::ptr FindSharedAppender(const ConfigAppenderMap &appenders, const std::string &logger_name,
+                                           const LogAppenderDefine &a, const std::string &pattern) {
+    for (auto &l : appenders) {
+        if (l.first == logger_name) continue;
+        for (auto &i : l.second) {
+            if (i.define == a && i.pattern == pattern) return i.appender;
+        }
+    }
+    return nullptr;
+}
+
 struct LogIniter {
     LogIniter() {
         g_log_defines->addListerner(0xF1E231, [](const std::set<LogDefine> &old_value, const std::set<LogDefine> &new_value) {
             SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "on_logger_conf_changed";
+            // 只修改有变化的 Logger, 其 Appender 按定义复用, 只创建新增的, 不再使用的随引用释放
+            static ConfigAppenderMap s_appenders;
+            ConfigAppenderMap appenders;
             for (auto &i : new_value) {
+                auto old_it = old_value.find(i);
+                auto &old_appenders = s_appenders[i.name];
+                if (old_it != old_value.end() && *old_it == i) {
+                    appenders[i.name] = old_appenders;
+                    continue;
+                }
                 // 新增或者修改 logger
                 auto logger = SYLAR_LOG_NAME(i.name);
-                logger->setLevel(i.level);
-                if (!i.formatter.empty()) logger->setFormatter(i.formatter);
-                logger->clearAppender();
+                if (logger->getLevel() != i.level) logger->setLevel(i.level);
+                if (!i.formatter.empty() && i.formatter != logger->getFormatter()->getPattern()) logger->setFormatter(i.formatter);
+                logger->setBinary(i.binary);
+                logger->setEveryN(i.every_n > 0 ? i.every_n : 0);
+                logger->setFirstN(i.first_n > 0 ? i.first_n : 0);
+                logger->setRateLimit(i.rate_limit > 0 ? i.rate_limit : 0);
+
+                std::vector<ConfigAppender> &list = appenders[i.name];
+                std::vector<bool> reused(old_appenders.size(), false);
+                Logger::AppenderList aps;
                 for (auto &a : i.appenders) {
-                    sylar::LogAppender::ptr ap;
-                    if (a.type == 1)
-                        ap.reset(new sylar::FileLogAppender(a.file));
-                    else if (a.type == 2)
-                        ap.reset(new sylar::StdoutLogAppender);
-                    ap->setLevel(a.level);
-                    if (!a.formatter.empty()) {
-                        LogFormatter::ptr fmt(new LogFormatter(a.formatter));
-                        if (!fmt->is_Error()) {
-                            ap->setHasFormatter(fmt);
-                        } else {
-                            std::cout << "logger name=" << i.name << " formatter=" << a.formatter << " is invalid" << std::endl;
+                    std::string pattern = a.formatter.empty() ? logger->getFormatter()->getPattern() : a.formatter;
+                    LogAppender::ptr ap;
+                    for (size_t n = 0; n < old_appenders.size() && !ap; ++n) {
+                        if (!reused[n] && old_appenders[n].define == a && old_appenders[n].pattern == pattern) {
+                            ap = old_appenders[n].appender;
+                            reused[n] = true;
                         }
                     }
-                    logger->addAppender(ap);
+                    if (!ap && IsSharedAppender(a)) {
+                        ap = FindSharedAppender(appenders, i.name, a, pattern);
+                        if (!ap) ap = FindSharedAppender(s_appenders, i.name, a, pattern);
+                    }
+                    if (!ap) ap = NewAppender(a, i.name);
+                    list.push_back(ConfigAppender{a, pattern, ap});
+                    aps.push_back(ap);
                 }
+                if (aps != *logger->getAppenders()) logger->setAppenders(aps);
             }
             for (auto &i : old_value) {
                 auto it = new_value.find(i);
                 if (it == new_value.end()) {
-                    // 删除 logger
+                    // 删除 logger, 恢复为继承上级
                     auto logger = SYLAR_LOG_NAME(i.name);
-                    logger->setLevel((LogLevel::Level)100);
+                    logger->setLevel(LogLevel::Unknow);
+                    logger->setBinary(false);
                     logger->clearAppender();
                 }
             }
+            s_appenders.swap(appenders);
+            LogSite::Invalidate();
+        });
+        g_binlog_file->addListerner(0xF1E232, [](const std::string &old_value, const std::string &new_value) {
+            if (new_value.empty()) {
+                BinLog::Close();
+            } else if (!BinLog::Open(new_value)) {
+                std::cout << "open binlog file " << new_value << " failed" << std::endl;
+            }
         });
     }
 };
@@ -557,22 +2783,120 @@ static LogIniter __log_init;
 void LogManager::init() {
 }
 
+std::map<std::string, uint64_t> LogManager::getDropped() const {
+    std::map<std::string, uint64_t> rt;
+    for (auto &l : *snapshot()) {
+        uint64_t n = 0;
+        for (auto &a : *l.second->getAppenders()) {
+            n += a->getDropped();
+        }
+        if (n) rt[l.first] = n;
+    }
+    return rt;
+}
+
+static int AppenderTypeOf(const LogAppender &ap) {
+    if (typeid(ap) == typeid(FileLogAppender)) return 1;
+    if (typeid(ap) == typeid(AsyncLogAppender)) return 3;
+    if (typeid(ap) == typeid(RollingFileLogAppender)) return 4;
+    if (typeid(ap) == typeid(MmapLogAppender)) return 5;
+    if (typeid(ap) == typeid(RingBufferLogAppender)) return 6;
+    if (typeid(ap) == typeid(ShmLogAppender)) return 7;
+    return 2;
+}
+
+std::string LogManager::statsJson() const {
+    nlohmann::json j;
+    nlohmann::json &loggers = j["loggers"];
+    loggers = nlohmann::json::object();
+    for (auto &l : *snapshot()) {
+        nlohmann::json events = nlohmann::json::object();
+        for (int level = LogLevel::Debug; level <= LogLevel::Fatal; ++level) {
+            uint64_t n = l.second->getEventCount((LogLevel::Level)level);
+            if (n) events[LogLevel::ToString((LogLevel::Level)level)] = n;
+        }
+        nlohmann::json appenders = nlohmann::json::array();
+        for (auto &a : *l.second->getAppenders()) {
+            nlohmann::json ja;
+            ja["type"] = AppenderTypeToString(AppenderTypeOf(*a));
+            auto async = std::dynamic_pointer_cast<AsyncLogAppender>(a);
+            // 异步 Appender 的字节数在其包装的 Appender 上
+            ja["bytes"] = async ? async->getAppender()->getBytes() : a->getBytes();
+            ja["dropped"] = a->getDropped();
+            appenders.push_back(ja);
+        }
+        nlohmann::json &jl = loggers[l.first];
+        jl["events"] = events;
+        jl["appenders"] = appenders;
+    }
+
+    LatencyHistogram hists[kLatencyKinds];
+    {
+        LatencyRegistry &registry = GetLatencyRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (int k = 0; k < kLatencyKinds; ++k) hists[k] = registry.retired[k];
+        for (auto i : registry.threads) i->mergeTo(hists);
+    }
+    j["format_ns"] = LatencyToJson(hists[kLatencyFormat]);
+    j["write_ns"] = LatencyToJson(hists[kLatencyWrite]);
+
+    std::stringstream ss;
+    ss << std::setw(4) << j;
+    return ss.str();
+}
+
 std::string LogManager::toJsonString() const {
     nlohmann::json j;
-    for (auto &l : m_loggers) {
+    for (auto &l : *snapshot()) {
         LogDefine ld;
         ld.name = l.first;
-        ld.level = l.second->m_level;
+        ld.level = l.second->getLevel();
         ld.formatter = l.second->m_formatter->getPattern();
-        for (auto &a : l.second->m_appenders) {
+        ld.binary = l.second->isBinary();
+        ld.every_n = l.second->getEveryN();
+        ld.first_n = l.second->getFirstN();
+        ld.rate_limit = l.second->getRateLimit();
+        for (auto &a : *l.second->getAppenders()) {
             LogAppenderDefine lad;
             if (typeid(*a) == typeid(FileLogAppender)) {
                 lad.type = 1;
-                lad.file = std::dynamic_pointer_cast<FileLogAppender>(a)->getFileName();
+                FileAppenderToDefine(std::dynamic_pointer_cast<FileLogAppender>(a), lad);
+            } else if (typeid(*a) == typeid(AsyncLogAppender)) {
+                auto async = std::dynamic_pointer_cast<AsyncLogAppender>(a);
+                lad.type = 3;
+                lad.capacity = async->getCapacity();
+                auto inner = std::dynamic_pointer_cast<FileLogAppender>(async->getAppender());
+                if (inner) FileAppenderToDefine(inner, lad);
+                auto rolling = std::dynamic_pointer_cast<RollingFileLogAppender>(async->getAppender());
+                if (rolling) RollingFileAppenderToDefine(rolling, lad);
+                auto stdout_ap = std::dynamic_pointer_cast<StdoutLogAppender>(async->getAppender());
+                if (stdout_ap) StdoutAppenderToDefine(stdout_ap, lad);
+            } else if (typeid(*a) == typeid(RollingFileLogAppender)) {
+                lad.type = 4;
+                RollingFileAppenderToDefine(std::dynamic_pointer_cast<RollingFileLogAppender>(a), lad);
+            } else if (typeid(*a) == typeid(MmapLogAppender)) {
+                lad.type = 5;
+                lad.file = std::dynamic_pointer_cast<MmapLogAppender>(a)->getFileName();
+            } else if (typeid(*a) == typeid(RingBufferLogAppender)) {
+                auto ring = std::dynamic_pointer_cast<RingBufferLogAppender>(a);
+                lad.type = 6;
+                lad.ring_size = ring->getSize();
+                lad.file = ring->getDumpFile();
+            } else if (typeid(*a) == typeid(ShmLogAppender)) {
+                auto shm = std::dynamic_pointer_cast<ShmLogAppender>(a);
+                lad.type = 7;
+                lad.ring_size = shm->getSize();
+                lad.file = shm->getFileName();
             } else {
                 lad.type = 2;
+                auto stdout_ap = std::dynamic_pointer_cast<StdoutLogAppender>(a);
+                if (stdout_ap) StdoutAppenderToDefine(stdout_ap, lad);
             }
             lad.level = a->getLevel();
+            if (a->getOverflow() != LogAppender::Block) {
+                lad.overflow = LogAppender::OverflowToString(a->getOverflow());
+                if (a->getOverflow() == LogAppender::DropBelowLevel) lad.drop_level = a->getDropLevel();
+            }
             if (a->hasFormatter()) lad.formatter = a->getFormatter()->getPattern();
             ld.appenders.push_back(lad);
         }
@@ -1,20 +1,36 @@
 #ifndef __SYLAR_LOG_H__
 #define __SYLAR_LOG_H__
 
+#include "./binlog.h"
 #include "./util.h"
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+// 编译期日志级别下限, 取值同 LogLevel::Level, 由 CMake 缓存变量 SYLAR_LOG_COMPILE_LEVEL 设置
+// 低于该级别的日志语句条件为常量 false, 编译后不产生代码; 其余级别仍做运行时判断
+#ifndef SYLAR_LOG_COMPILE_LEVEL
+#define SYLAR_LOG_COMPILE_LEVEL 0
+#endif
+
+// 每个日志宏展开处的静态调用点记录, 见 LogSite
+#define SYLAR_LOG_SITE() ([]() -> sylar::LogSite & { static sylar::LogSite s; return s; }())
+
 #define SYLAR_LOG_LEVEL(logger, level) \
-    if (logger->getLevel() <= level) \
-    sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, __FILE__, __LINE__, 0, sylar::GetThreadId(), sylar::GetFiberId(), time(0)))).getSS()
+    if ((int)(level) < SYLAR_LOG_COMPILE_LEVEL) { \
+    } else if (SYLAR_LOG_SITE().enabled(*logger, level)) \
+    sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, __FILE__, __LINE__, sylar::GetThreadId(), sylar::GetFiberId())).getSS()
 
 #define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::Debug)
 #define SYLAR_LOG_INFO(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::Info)
@@ -23,8 +39,12 @@
 #define SYLAR_LOG_FATAL(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::Fatal)
 
 #define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...) \
-    if (logger->getLevel() <= level) \
-    sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, __FILE__, __LINE__, 0, sylar::GetThreadId(), sylar::GetFiberId(), time(0)))).getEvent()->format(fmt, __VA_ARGS__)
+    if ((int)(level) < SYLAR_LOG_COMPILE_LEVEL) { \
+    } else if (!SYLAR_LOG_SITE().enabled(*logger, level)) { \
+    } else if (uint32_t __sylar_binlog_id = logger->getBinLogId()) \
+        sylar::BinLog::Write(__sylar_binlog_id, sylar::BinLog::GetSiteId([]() -> sylar::BinLog::Site & { static sylar::BinLog::Site s; return s; }(), level, __FILE__, __LINE__, fmt), level, __VA_ARGS__); \
+    else \
+    sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, __FILE__, __LINE__, sylar::GetThreadId(), sylar::GetFiberId())).getEvent()->format(fmt, __VA_ARGS__)
 
 #define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::Debug, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_INFO(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::Info, fmt, __VA_ARGS__)
@@ -32,8 +52,30 @@
 #define SYLAR_LOG_FMT_ERROR(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::Error, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_FATAL(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::Fatal, fmt, __VA_ARGS__)
 
+// 采样与限流, 每个调用点有独立的无锁计数状态, 见 LogSampler
+// 被跳过的条数会以 "[suppressed N] " 的形式出现在该调用点下一条输出的日志开头
+// 参数可以被 Logger 的配置(logs 中的 every_n / first_n / rate_limit)覆盖
+#define SYLAR_LOG_SAMPLED(logger, level, check) \
+    if ((int)(level) < SYLAR_LOG_COMPILE_LEVEL) { \
+    } else if (!SYLAR_LOG_SITE().enabled(*logger, level)) { \
+    } else if (sylar::LogSampler::Result __sylar_sample = ([]() -> sylar::LogSampler & { static sylar::LogSampler s; return s; }()).check) \
+    sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, __FILE__, __LINE__, sylar::GetThreadId(), sylar::GetFiberId())).getSS() << __sylar_sample
+
+// 每 n 条输出一条
+#define SYLAR_LOG_EVERY_N(logger, level, n) \
+    SYLAR_LOG_SAMPLED(logger, level, everyN(logger->getEveryN() ? logger->getEveryN() : (n)))
+// 只输出前 n 条
+#define SYLAR_LOG_FIRST_N(logger, level, n) \
+    SYLAR_LOG_SAMPLED(logger, level, firstN(logger->getFirstN() ? logger->getFirstN() : (n)))
+// 令牌桶限流, 每秒最多 per_sec 条, 允许一秒的突发
+#define SYLAR_LOG_RATE_LIMITED(logger, level, per_sec) \
+    SYLAR_LOG_SAMPLED(logger, level, rateLimited(logger->getRateLimit() ? logger->getRateLimit() : (per_sec)))
+
 #define SYLAR_LOG_ROOT() sylar::LogManager::GetInstance()->getRoot()
 #define SYLAR_LOG_NAME(name) sylar::LogManager::GetInstance()->getLogger(name)
+// 在调用点的静态变量中缓存查找结果, 之后不再查表; name 须为常量(Logger 创建后不会被移除)
+#define SYLAR_LOG_NAME_CACHED(name) \
+    ([]() -> const sylar::Logger::ptr & { static const sylar::Logger::ptr s_logger = SYLAR_LOG_NAME(name); return s_logger; }())
 
 namespace sylar {
 
@@ -56,24 +98,181 @@ public:
     static LogLevel::Level FromString(const std::string &str);
 };
 
+// 日志内容流, 替代 std::stringstream
+// 内容写入对象内的固定缓冲, 超出时才分配堆内存, 清空时保留已分配的缓冲
+class LogStream {
+public:
+    static const size_t kInlineSize = 512;
+
+    LogStream();
+    ~LogStream();
+    LogStream(const LogStream &) = delete;
+    LogStream &operator=(const LogStream &) = delete;
+
+    // 结构化字段, 与文本内容分开存放, 由 %k 按 logfmt 或 JSON 输出
+    struct Field {
+        enum Type : uint8_t {
+            Int,
+            UInt,
+            Double,
+            Bool,
+            String
+        };
+        Type type;
+        uint32_t key;       // 键在字段文本中的偏移
+        uint32_t keyLength;
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            bool b;
+            struct {
+                uint32_t offset; // 字符串值在字段文本中的偏移
+                uint32_t length;
+            } str;
+        };
+    };
+    static const size_t kInlineFields = 8;
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    std::string str() const { return std::string(m_data, m_size); }
+    void clear() {
+        m_size = 0;
+        m_fieldCount = 0;
+        m_moreFields.clear();
+        m_fieldText.clear();
+    }
+
+    // 添加结构化字段, 如 SYLAR_LOG_INFO(logger).kv("user", id).kv("latency_us", t)
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, LogStream &>::type
+    kv(const char *key, T v) {
+        addField(key, Field::Int).i = v;
+        return *this;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, LogStream &>::type
+    kv(const char *key, T v) {
+        addField(key, Field::UInt).u = v;
+        return *this;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value, LogStream &>::type
+    kv(const char *key, T v) {
+        addField(key, Field::Double).d = v;
+        return *this;
+    }
+    LogStream &kv(const char *key, bool v) {
+        addField(key, Field::Bool).b = v;
+        return *this;
+    }
+    LogStream &kv(const char *key, const char *v) { return kvString(key, v ? v : "", v ? strlen(v) : 0); }
+    LogStream &kv(const char *key, char *v) { return kv(key, (const char *)v); }
+    LogStream &kv(const char *key, const std::string &v) { return kvString(key, v.data(), v.size()); }
+    // 其他类型借助其 ostream operator<< 转为字符串
+    template <typename T>
+    typename std::enable_if<!std::is_arithmetic<T>::value, LogStream &>::type
+    kv(const char *key, const T &v) {
+        std::ostringstream ss;
+        ss << v;
+        const std::string &str = ss.str();
+        return kvString(key, str.data(), str.size());
+    }
+
+    size_t fieldCount() const { return m_fieldCount + m_moreFields.size(); }
+    const Field &field(size_t i) const { return i < kInlineFields ? m_fields[i] : m_moreFields[i - kInlineFields]; }
+    const char *fieldText() const { return m_fieldText.data(); }
+
+    void append(const char *data, size_t len);
+    // 保证至少 len 字节可写, 返回写入位置, 写完后用 commit 提交实际长度
+    char *reserve(size_t len);
+    void commit(size_t len) { m_size += len; }
+
+    LogStream &operator<<(bool v) { return *this << (char)(v ? '1' : '0'); }
+    LogStream &operator<<(char v);
+    LogStream &operator<<(signed char v) { return *this << (char)v; }
+    LogStream &operator<<(unsigned char v) { return *this << (char)v; }
+    LogStream &operator<<(short v) { return appendSigned(v); }
+    LogStream &operator<<(unsigned short v) { return appendUnsigned(v); }
+    LogStream &operator<<(int v) { return appendSigned(v); }
+    LogStream &operator<<(unsigned int v) { return appendUnsigned(v); }
+    LogStream &operator<<(long v) { return appendSigned(v); }
+    LogStream &operator<<(unsigned long v) { return appendUnsigned(v); }
+    LogStream &operator<<(long long v) { return appendSigned(v); }
+    LogStream &operator<<(unsigned long long v) { return appendUnsigned(v); }
+    LogStream &operator<<(float v) { return *this << (double)v; }
+    LogStream &operator<<(double v);
+    LogStream &operator<<(long double v);
+    LogStream &operator<<(const char *v);
+    LogStream &operator<<(char *v) { return *this << (const char *)v; }
+    LogStream &operator<<(const std::string &v);
+    LogStream &operator<<(const void *v);
+
+    template <typename T>
+    LogStream &operator<<(T *v) { return *this << (const void *)v; }
+
+    // 其他类型借助其 ostream operator<< 输出
+    template <typename T>
+    LogStream &operator<<(const T &v) {
+        std::ostringstream ss;
+        ss << v;
+        const std::string &str = ss.str();
+        append(str.data(), str.size());
+        return *this;
+    }
+
+private:
+    LogStream &appendSigned(long long v);
+    LogStream &appendUnsigned(unsigned long long v);
+    Field &addField(const char *key, Field::Type type);
+    LogStream &kvString(const char *key, const char *v, size_t len);
+
+private:
+    char *m_data;
+    size_t m_size = 0;
+    size_t m_capacity = kInlineSize;
+    char m_inline[kInlineSize];
+    Field m_fields[kInlineFields];
+    size_t m_fieldCount = 0;
+    std::vector<Field> m_moreFields; // 超过 kInlineFields 的字段
+    std::string m_fieldText;         // 字段的键与字符串值, 池化复用时保留容量
+};
+
 // 日志事件
 class LogEvent {
 public:
     typedef std::shared_ptr<LogEvent> ptr;
-    LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse,
+    LogEvent(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse,
              uint32_t thread_id, uint32_t fiber_id, uint64_t time);
 
+    // 从线程本地对象池取出事件, 池中事件没有其他持有者时原地重置复用, 不再分配内存
+    static LogEvent::ptr Create(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line,
+                                uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time);
+    // 同上, 时间戳(纳秒精度)与 elapse 取自 util 中的时钟
+    static LogEvent::ptr Create(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line,
+                                uint32_t thread_id, uint32_t fiber_id);
+    // 持有者用完事件后调用: 只剩池与调用者持有时释放对 Logger 的引用,
+    // 避免池中闲置的事件让局部 Logger 及其 Appender 在作用域结束后仍存活
+    static void Release(const LogEvent::ptr &event);
+
     const char *getFile() const { return m_file; }
     int32_t getLine() const { return m_line; }
     uint32_t getElapse() const { return m_elapse; }
     uint32_t getThreadId() const { return m_threadId; }
     uint32_t getFiberId() const { return m_fiberId; }
     uint64_t getTime() const { return m_time; }
+    uint32_t getNanoSec() const { return m_nsec; }
+    void setTime(uint64_t sec, uint32_t nsec) { m_time = sec, m_nsec = nsec; }
+    uint64_t getTimeNS() const { return m_time * 1000000000ull + m_nsec; }
     std::string getContent() const { return m_ss.str(); }
-    std::shared_ptr<Logger> getLogger() const { return m_logger; }
+    // 日志内容, 直接指向 LogStream 缓冲, 不拷贝
+    const char *getContentData() const { return m_ss.data(); }
+    size_t getContentSize() const { return m_ss.size(); }
+    const std::shared_ptr<Logger> &getLogger() const { return m_logger; }
     LogLevel::Level getLevel() const { return m_level; }
 
-    std::stringstream &getSS() { return m_ss; }
+    LogStream &getSS() { return m_ss; }
     void format(const char *fmt, ...);
 
 private:
@@ -83,10 +282,12 @@ private:
     uint32_t m_threadId = 0;      // 线程 id
     uint32_t m_fiberId = 0;       // 协程 id
     uint64_t m_time;              // 时间戳
-    std::stringstream m_ss;
+    uint32_t m_nsec = 0;          // 时间戳的纳秒部分
+    LogStream m_ss;
 
     std::shared_ptr<Logger> m_logger;
     LogLevel::Level m_level;
+    bool m_pooled = false; // 是否由事件池持有
 };
 
 class LogEventWrap {
@@ -94,59 +295,213 @@ public:
     LogEventWrap(LogEvent::ptr e);
     ~LogEventWrap();
 
-    LogEvent::ptr getEvent() const { return m_event; }
+    const LogEvent::ptr &getEvent() const { return m_event; }
 
-    std::stringstream &getSS();
+    LogStream &getSS();
 
 private:
     LogEvent::ptr m_event;
 };
 
 // 日志格式器
+// pattern 编译为扁平的指令数组, 字面量集中存放在一个字符串中, format 时逐条解释执行
 class LogFormatter {
 public:
     typedef std::shared_ptr<LogFormatter> ptr;
     LogFormatter(const std::string &pattern);
 
-    std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
+    std::string format(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event);
+    // 追加到调用方提供的缓冲
+    void format(std::string &out, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) const;
+    // 经由 FormatItem 逐项输出
+    std::ostream &format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event);
 
 public:
     class FormatItem {
     public:
         typedef std::shared_ptr<FormatItem> ptr;
         virtual ~FormatItem() {}
-        virtual void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+        virtual void format(std::ostream &os, const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) = 0;
     };
 
     void init();
     bool is_Error() const { return m_error; }
     std::string getPattern() const { return m_pattern; }
 
+private:
+    // 编译后的指令, 字面量为 m_literals 中的 [offset, offset + length)
+    struct Op {
+        uint32_t code;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    void addLiteral(const std::string &str);
+
 private:
     std::string m_pattern;
     std::vector<FormatItem::ptr> m_items;
+    std::vector<Op> m_ops;
+    std::string m_literals;
     bool m_error = false;
 };
 
+// 日志调用点
+// 缓存该调用点在所用 Logger 上是否启用(综合 Logger 与 Appender 的级别), 与全局配置代数一起存放
+// 日志级别、Appender 集合等配置变化时递增代数, 各调用点在下次执行时重新计算
+// 静态存储零初始化即为有效状态, 无需构造
+class LogSite {
+public:
+    bool enabled(const Logger &logger, LogLevel::Level level);
+
+    // 配置变化时调用, 使所有调用点的缓存失效
+    static void Invalidate() { s_generation.fetch_add(1, std::memory_order_release); }
+    // 当前代数, 代数不变说明其间没有配置变化
+    static uint32_t Generation() { return s_generation.load(std::memory_order_acquire); }
+
+private:
+    bool update(const Logger &logger, LogLevel::Level level);
+
+    // 代数(高 32 位) | Logger id(28 位) | 日志级别(3 位) | 是否启用(最低位)
+    // 级别也参与比较, 宏的 level 参数可以是变量
+    std::atomic<uint64_t> m_state;
+    static std::atomic<uint32_t> s_generation; // 从 1 开始, 零初始化的调用点必然失效
+};
+
+// 一次日志事件的渲染结果
+// Logger 把同一个缓存依次交给各个 Appender, 共用同一 LogFormatter 的 Appender 只渲染一次
+class LogRenderCache {
+public:
+    LogRenderCache();
+    ~LogRenderCache();
+    LogRenderCache(const LogRenderCache &) = delete;
+    LogRenderCache &operator=(const LogRenderCache &) = delete;
+
+    // 返回 formatter 对该事件的渲染结果, 在缓存销毁前有效(超出缓存容量的只保证到下一次 render)
+    const std::string &render(const LogFormatter::ptr &formatter, const std::shared_ptr<Logger> &logger,
+                              LogLevel::Level level, const LogEvent::ptr &event);
+
+    static const size_t kEntries = 4;
+
+private:
+    const LogFormatter *m_formatters[kEntries];
+    size_t m_count = 0;
+    std::string *m_strings;               // kEntries + 1 个缓冲, 来自线程本地缓冲池
+    std::unique_ptr<std::string[]> m_own; // 嵌套过深, 线程本地缓冲用尽时使用
+};
+
+// 调用点的采样与限流状态, 零初始化即可使用
+class LogSampler {
+public:
+    struct Result {
+        bool pass;
+        uint64_t suppressed; // 上次输出以来被跳过的条数
+        explicit operator bool() const { return pass; }
+    };
+
+    Result everyN(uint64_t n) {
+        if (n > 1 && m_count.fetch_add(1, std::memory_order_relaxed) % n != 0) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return Result{false, 0};
+        }
+        return pass();
+    }
+
+    Result firstN(uint64_t n) {
+        // 超出后不再修改计数, 避免争用
+        if (m_count.load(std::memory_order_relaxed) >= n ||
+            m_count.fetch_add(1, std::memory_order_relaxed) >= n) {
+            return Result{false, 0};
+        }
+        return Result{true, 0};
+    }
+
+    // GCRA 算法, 一次 CAS 更新理论到达时间
+    Result rateLimited(uint64_t per_sec);
+
+private:
+    Result pass() {
+        uint64_t suppressed = 0;
+        if (m_suppressed.load(std::memory_order_relaxed)) {
+            suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+        }
+        return Result{true, suppressed};
+    }
+
+    std::atomic<uint64_t> m_count;      // EVERY_N / FIRST_N 的调用计数
+    std::atomic<uint64_t> m_tat;        // RATE_LIMITED 的理论到达时间(ns)
+    std::atomic<uint64_t> m_suppressed; // 待报告的跳过条数
+};
+
+LogStream &operator<<(LogStream &os, const LogSampler::Result &v);
+
+// 分段计数器, 各线程按编号写入不同缓存行上的分段, 读取时求和
+class LogCounter {
+public:
+    static const size_t kStripes = 8;
+
+    LogCounter();
+    LogCounter(const LogCounter &) = delete;
+    LogCounter &operator=(const LogCounter &) = delete;
+
+    void add(uint64_t n) { m_cells[Stripe()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const;
+
+private:
+    static size_t Stripe();
+
+    struct Cell {
+        std::atomic<uint64_t> value;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+    Cell m_cells[kStripes];
+};
+
 // 日志输出地
 class LogAppender {
 public:
     typedef std::shared_ptr<LogAppender> ptr;
     virtual ~LogAppender() {}
 
-    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+    // 写出跟不上时(缓冲队列已满)的处理方式, 仅对带队列的 Appender 生效, Fatal 总是等待
+    enum Overflow {
+        Block = 0,         // 等待队列腾出空间
+        DropNewest = 1,    // 丢弃当前日志
+        DropOldest = 2,    // 丢弃队列中最早的日志, Error / Fatal 除外
+        DropBelowLevel = 3 // 丢弃低于 drop level 的日志, 其余等待
+    };
+    static const char *OverflowToString(Overflow val);
+    static Overflow OverflowFromString(const std::string &str);
 
-    void setFormatter(LogFormatter::ptr val) { m_formatter = val; }
+    virtual void log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) = 0;
+    // 由 Logger 调用, 通过 cache 复用其他 Appender 已渲染的结果, 默认直接调用 log
+    virtual void dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                          LogRenderCache &cache) { log(logger, level, event); }
+    // 将已缓冲的日志写出
+    virtual void flush() {}
+
+    virtual void setFormatter(LogFormatter::ptr val) { m_formatter = val; }
     LogFormatter::ptr getFormatter() const { return m_formatter; }
 
-    void setLevel(LogLevel::Level level) { m_level = level; }
-    LogLevel::Level getLevel() const { return m_level; }
+    void setLevel(LogLevel::Level level) { m_level.store(level, std::memory_order_relaxed), LogSite::Invalidate(); }
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
 
     bool hasFormatter() const { return m_hasFormatter; }
-    void setHasFormatter(LogFormatter::ptr val) { m_formatter = val, m_hasFormatter = true; }
+    void setHasFormatter(LogFormatter::ptr val) { setFormatter(val), m_hasFormatter = true; }
+
+    Overflow getOverflow() const { return m_overflow; }
+    LogLevel::Level getDropLevel() const { return m_dropLevel; }
+    void setOverflow(Overflow val, LogLevel::Level drop_level = LogLevel::Warn) { m_overflow = val, m_dropLevel = drop_level; }
+    // 按 Overflow 策略丢弃的日志条数
+    virtual uint64_t getDropped() const { return 0; }
+    // 已写出(格式化后)的字节数
+    uint64_t getBytes() const { return m_bytes.get(); }
 
 protected:
-    LogLevel::Level m_level = LogLevel::Debug;
+    LogCounter m_bytes;
+    Overflow m_overflow = Block;
+    LogLevel::Level m_dropLevel = LogLevel::Warn;
+    std::atomic<LogLevel::Level> m_level{LogLevel::Debug}; // 重新加载配置时与 log 并发读写
     LogFormatter::ptr m_formatter;
     bool m_hasFormatter = false;
 };
@@ -157,21 +512,47 @@ class Logger : public std::enable_shared_from_this<Logger> {
 
 public:
     typedef std::shared_ptr<Logger> ptr;
+    typedef std::vector<LogAppender::ptr> AppenderList;
 
     Logger(const std::string &name = "root");
-    void log(LogLevel::Level level, LogEvent::ptr event);
+    ~Logger();
+    void log(LogLevel::Level level, const LogEvent::ptr &event);
 
-    void debug(LogEvent::ptr event);
-    void info(LogEvent::ptr event);
-    void warn(LogEvent::ptr event);
-    void error(LogEvent::ptr event);
-    void fatal(LogEvent::ptr event);
+    void debug(const LogEvent::ptr &event);
+    void info(const LogEvent::ptr &event);
+    void warn(const LogEvent::ptr &event);
+    void error(const LogEvent::ptr &event);
+    void fatal(const LogEvent::ptr &event);
 
     void addAppender(LogAppender::ptr appender);
     void delAppender(LogAppender::ptr appender);
     void clearAppender();
-    LogLevel::Level getLevel() const { return m_level; }
-    void setLevel(LogLevel::Level val) { m_level = val; }
+    // 整体替换 Appender 集合, 不经过中间的空集合
+    void setAppenders(const AppenderList &appenders);
+    // 当前 Appender 集合的快照, 不可修改
+    std::shared_ptr<const AppenderList> getAppenders() const;
+    // 配置的级别, Unknow 表示继承上级
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+    void setLevel(LogLevel::Level val);
+    // 实际生效的级别与 Appender 集合, 配置变化时由上级向下推送, log 时不再逐级查找
+    LogLevel::Level getEffectiveLevel() const { return m_effectiveLevel.load(std::memory_order_relaxed); }
+    std::shared_ptr<const AppenderList> getEffectiveAppenders() const;
+    // 上级 Logger: 名称按 '.' 分级, 为已存在的最近一级祖先, 没有时为 root
+    Logger::ptr getParent() const;
+
+    // 覆盖 SYLAR_LOG_EVERY_N / FIRST_N / RATE_LIMITED 的参数, 0 为使用宏中的参数
+    uint32_t getEveryN() const { return m_everyN.load(std::memory_order_relaxed); }
+    void setEveryN(uint32_t val) { m_everyN.store(val, std::memory_order_relaxed); }
+    uint32_t getFirstN() const { return m_firstN.load(std::memory_order_relaxed); }
+    void setFirstN(uint32_t val) { m_firstN.store(val, std::memory_order_relaxed); }
+    uint32_t getRateLimit() const { return m_rateLimit.load(std::memory_order_relaxed); }
+    void setRateLimit(uint32_t val) { m_rateLimit.store(val, std::memory_order_relaxed); }
+
+    // 该级别的日志是否会被输出, 未命中调用点缓存时使用
+    bool isEnabled(LogLevel::Level level) const;
+    uint32_t getId() const { return m_id; }
+    // 经 log 输出的各级别日志条数
+    uint64_t getEventCount(LogLevel::Level level) const { return level <= LogLevel::Fatal ? m_events[level].get() : 0; }
 
     const std::string &getName() const { return m_name; }
 
@@ -179,57 +560,425 @@ public:
     void setFormatter(LogFormatter::ptr val);
     LogFormatter::ptr getFormatter() const;
 
+    // 二进制模式下 SYLAR_LOG_FMT_* 写入 BinLog, 不经过 Appender
+    void setBinary(bool val);
+    bool isBinary() const { return getBinLogId() != 0; }
+    uint32_t getBinLogId() const { return m_binlogId.load(std::memory_order_relaxed); }
+
 private:
+    uint32_t m_id;                           // 进程内唯一 id, 用于调用点缓存
     std::string m_name;                      // 日志名称
-    LogLevel::Level m_level;                 // 日志级别
-    std::list<LogAppender::ptr> m_appenders; // Appender集合
+    std::atomic<LogLevel::Level> m_level;    // 日志级别
+    // Appender集合, 写时复制: 修改时在 m_mutex 下复制出新集合, 在层级锁下替换
+    std::shared_ptr<const AppenderList> m_appenders;
+    std::mutex m_mutex;
     LogFormatter::ptr m_formatter;
-
-    Logger::ptr m_root;
+    std::atomic<uint32_t> m_binlogId;        // 二进制模式下的 Logger id, 0 为文本模式
+    uint32_t m_binlogDefine = 0;             // 已分配的 Logger id, 关闭后再开启时复用
+    std::atomic<uint32_t> m_everyN{0};
+    std::atomic<uint32_t> m_firstN{0};
+    std::atomic<uint32_t> m_rateLimit{0};
+    LogCounter m_events[LogLevel::Fatal + 1];
+
+    // 层级关系, 在全局层级锁下修改
+    void updateEffective();
+    // log 使用的生效 Appender 集合, 取自每线程缓存, 本 Logger 的集合未变化时不加锁
+    std::shared_ptr<const AppenderList> cachedAppenders() const;
+    std::atomic<LogLevel::Level> m_effectiveLevel;
+    // 自身为空时为上级的集合, 在层级锁与 m_effectiveMutex 下修改, 读取只需 m_effectiveMutex
+    std::shared_ptr<const AppenderList> m_effectiveAppenders;
+    mutable std::mutex m_effectiveMutex;
+    std::atomic<uint32_t> m_effectiveVersion; // m_effectiveAppenders 每次替换后加一
+    Logger::ptr m_parent;
+    std::vector<Logger *> m_children;
 };
 
+inline bool LogSite::enabled(const Logger &logger, LogLevel::Level level) {
+    uint64_t state = m_state.load(std::memory_order_relaxed);
+    if ((uint32_t)(state >> 32) == s_generation.load(std::memory_order_relaxed) &&
+        ((uint32_t)state >> 1) == (logger.getId() << 3 | (uint32_t)level)) {
+        return state & 1;
+    }
+    return update(logger, level);
+}
+
 // 输出到控制台的 Appender
+// 直接写标准输出句柄, 不经过 std::cout; 输出为控制台时默认每行写出, 否则缓冲写出
 class StdoutLogAppender : public LogAppender {
 public:
     typedef std::shared_ptr<StdoutLogAppender> ptr;
-    void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+    static const size_t kBufferSize = 8 * 1024;
+    static const uint64_t kFlushInterval = 1000; // 缓冲最长保留的毫秒数
+
+    StdoutLogAppender();
+    ~StdoutLogAppender();
+    void log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+    void dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                  LogRenderCache &cache) override;
+    void flush() override;
+
+    // 不低于该级别的日志写到 stderr, Unknow 为全部写到 stdout
+    void setStderrLevel(LogLevel::Level val) { m_stderrLevel = val; }
+    LogLevel::Level getStderrLevel() const { return m_stderrLevel; }
+
+    // 输出为控制台时是否每行立即写出
+    void setTtyFlush(bool val) { m_ttyFlush = val; }
+    bool getTtyFlush() const { return m_ttyFlush; }
+
+private:
+    struct Stream {
+        HANDLE handle;
+        bool tty;              // 是否为控制台
+        std::string buffer;
+        uint64_t lastFlush;    // 上次写出时间(ms)
+    };
+
+    static void Init(Stream &stream, DWORD std_handle);
+    static void Write(Stream &stream);
+
+    Stream m_out;
+    Stream m_err;
+    LogLevel::Level m_stderrLevel = LogLevel::Unknow;
+    bool m_ttyFlush = true;
+    std::mutex m_mutex;
+    uint64_t m_flushTask = 0; // 后台定时写出任务 id
+};
+
+// 文件写出端, 进程内按规范化的绝对路径共用一个实例
+// 写同一文件的 FileLogAppender 共用其缓冲与句柄, 整行追加到缓冲, 交换缓冲后一次写出
+class LogFileSink {
+public:
+    typedef std::shared_ptr<LogFileSink> ptr;
+    static const size_t kDefaultBufferSize = 8 * 1024;
+
+    // 取得路径对应的写出端, 没有时打开文件
+    static LogFileSink::ptr Get(const std::string &filename);
+    // 规范化的绝对路径, 作为注册的键
+    static std::string CanonicalPath(const std::string &filename);
+
+    ~LogFileSink();
+    LogFileSink(const LogFileSink &) = delete;
+    LogFileSink &operator=(const LogFileSink &) = delete;
+
+    // 追加一行到缓冲, 返回追加后缓冲的字节数
+    size_t append(const std::string &str);
+    void flush();
+    bool reopen();
+    void reserve(size_t size);
+    // 设置定时写出间隔(ms), 多个 Appender 共用时取较小值, 0 忽略
+    void setFlushInterval(uint64_t ms);
+
+    const std::string &getFileName() const { return m_filename; }
+    uint64_t getLastFlush() const { return m_lastFlush.load(std::memory_order_relaxed); }
 
 private:
+    LogFileSink(const std::string &filename);
+
+    std::string m_filename;
+    HANDLE m_file;
+    std::string m_front;                // 前台缓冲, 受 m_mutex 保护
+    std::string m_back;                 // 后台缓冲, 受 m_writeMutex 保护
+    std::atomic<uint64_t> m_lastFlush;  // 上次写出时间(ms)
+    std::atomic<uint64_t> m_interval;   // 定时写出间隔(ms), 0 为不定时
+    uint64_t m_flushTask = 0;           // 后台定时写出任务 id, 受 m_taskMutex 保护
+    std::mutex m_mutex;                 // 保护前台缓冲
+    std::mutex m_writeMutex;            // 保护文件句柄, 写文件时不阻塞其他线程追加前台缓冲
+    std::mutex m_taskMutex;             // 保护定时写出任务的注册
 };
 
 // 输出到文件的 Appender
 class FileLogAppender : public LogAppender {
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
+
+    // 缓冲写出策略, 日志先追加到写出端的缓冲, 满足任一条件时一次写出
+    // bytes 为 0 时按 LogFileSink::kDefaultBufferSize 缓冲, 与原先文件流自带的缓冲相当
+    struct FlushPolicy {
+        size_t bytes = 0;                         // 缓冲达到该字节数
+        uint64_t interval = 0;                    // 距上次写出超过该毫秒数, 0 不启用
+        LogLevel::Level level = LogLevel::Unknow; // 日志级别不低于该级别, Unknow 不启用
+    };
+
     FileLogAppender(const std::string &filename);
-    void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+    ~FileLogAppender();
+    void log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+    void dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                  LogRenderCache &cache) override;
+    void flush() override;
 
-    // 重新打开文件，文件打开成功返回 true
+    // 重新打开文件(同一文件的 Appender 共用), 文件打开成功返回 true
     bool reopen();
 
     std::string getFileName() const { return m_filename; }
 
+    void setFlushPolicy(const FlushPolicy &val);
+    const FlushPolicy &getFlushPolicy() const { return m_policy; }
+
+private:
+    std::string m_filename;
+    LogFileSink::ptr m_sink;
+    FlushPolicy m_policy;
+};
+
+// 滚动文件 Appender
+// 按大小或时间(每小时/每天)切换文件, 当前文件始终为 filename, 旧文件依次为 filename.1 filename.2 ...
+// 下一个文件由后台线程提前创建并预分配磁盘空间, 切换时写入线程只交换文件句柄,
+// 旧文件的关闭、改名与清理都在后台线程完成
+class RollingFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<RollingFileLogAppender> ptr;
+
+    enum Mode {
+        Size = 0,   // 超过 max_size 字节时切换
+        Hourly = 1, // 每小时切换
+        Daily = 2   // 每天 0 点切换
+    };
+
+    static const char *ModeToString(Mode mode);
+    static Mode ModeFromString(const std::string &str);
+
+    // max_files 为保留的旧文件数, 0 为不限制
+    RollingFileLogAppender(const std::string &filename, Mode mode, uint64_t max_size = 0, int max_files = 0);
+    ~RollingFileLogAppender();
+    void log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+    void dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                  LogRenderCache &cache) override;
+    void flush() override;
+
+    std::string getFileName() const { return m_filename; }
+    Mode getMode() const { return m_mode; }
+    uint64_t getMaxSize() const { return m_maxSize; }
+    int getMaxFiles() const { return m_maxFiles; }
+
+private:
+    struct Context;
+    static void Run(std::shared_ptr<Context> ctx);
+
+    bool rotate(); // 切换到后台准备好的文件, 未准备好时返回 false
+    void writeBuffer();
+    void updateNextRotate(uint64_t now);
+
+    std::string m_filename;
+    Mode m_mode;
+    uint64_t m_maxSize;
+    int m_maxFiles;
+    HANDLE m_handle;
+    uint64_t m_written = 0;    // 当前文件已写入字节数
+    uint64_t m_nextRotate = 0; // 按时间切换时, 下次切换的时间戳(秒)
+    std::string m_buffer;      // 写缓冲
+    std::mutex m_mutex;
+    std::shared_ptr<Context> m_ctx;
+    std::thread m_thread;
+};
+
+// 内存映射文件 Appender
+// 文件按 kChunkSize 分块映射, 写入线程通过原子游标无锁预留空间后直接拷贝到映射内存,
+// 由系统负责写回磁盘; 写满的块自动解除映射, 映射与扩展文件只在跨块时加锁
+// 正常关闭时截断到实际写入长度, 打开时去掉上次异常退出遗留的尾部空字节
+class MmapLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<MmapLogAppender> ptr;
+    static const uint64_t kChunkSize = 16 * 1024 * 1024;
+
+    MmapLogAppender(const std::string &filename);
+    ~MmapLogAppender();
+    void log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+    void dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                  LogRenderCache &cache) override;
+    void flush() override;
+
+    std::string getFileName() const { return m_filename; }
+
 private:
+    // 同时映射的块数, 块 i 使用 m_chunks[i % kChunkSlots]
+    static const size_t kChunkSlots = 8;
+    static const uint64_t kNoChunk = ~0ull;
+
+    struct Chunk {
+        std::atomic<uint64_t> index; // 映射的块序号, kNoChunk 为空闲
+        std::atomic<char *> base;
+        std::atomic<uint64_t> done;  // 已写完的字节数, 达到 kChunkSize 时解除映射
+    };
+
+    void write(uint64_t pos, const char *data, size_t len);
+    Chunk *getChunk(uint64_t index);
+    void commit(Chunk *chunk, size_t len);
+    // 映射失败时放弃已预留的范围, 以换行填充并计入 done, 保证块最终能解除映射
+    void skip(uint64_t pos, size_t len);
+
     std::string m_filename;
-    std::ofstream m_filestream;
+    HANDLE m_file;
+    HANDLE m_mapping = NULL;
+    uint64_t m_mappingSize = 0;      // 当前映射对象(文件)的大小
+    uint64_t m_start = 0;            // 打开时已有的数据长度
+    std::atomic<uint64_t> m_cursor;  // 下一个写入位置
+    Chunk m_chunks[kChunkSlots];
+    std::mutex m_mutex;              // 保护映射与解除映射
+    // 所在块尚未映射时放弃的范围(块内偏移, 长度), 按块序号记录, 该块映射时再填充
+    std::map<uint64_t, std::vector<std::pair<uint64_t, uint64_t> > > m_skipped;
+};
+
+// 内存环形缓冲 Appender, 保留最近 size 字节的已格式化日志, 稳态下没有任何 I/O
+// 可按级别 / Logger / 时间范围查询或导出; 设置了 dump_file 时, 收到 Fatal 后把缓冲内容追加写入该文件
+class RingBufferLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<RingBufferLogAppender> ptr;
+    static const size_t kDefaultSize = 4 * 1024 * 1024;
+
+    struct Record {
+        LogLevel::Level level;
+        uint64_t time; // 纳秒时间戳
+        std::string logger;
+        std::string text;
+    };
+
+    // 查询条件, 默认匹配全部
+    struct Filter {
+        Filter() : level(LogLevel::Unknow), begin(0), end(~0ull) {}
+
+        LogLevel::Level level; // 不低于该级别
+        std::string logger;    // 该 Logger 及其下级, 为空时不限
+        uint64_t begin;        // 时间范围 [begin, end), 纳秒
+        uint64_t end;
+    };
+
+    RingBufferLogAppender(size_t size = kDefaultSize, const std::string &dump_file = "");
+    void log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+    void dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                  LogRenderCache &cache) override;
+
+    // 按时间顺序返回匹配的日志
+    std::vector<Record> query(const Filter &filter = Filter()) const;
+    // 写出匹配的日志文本
+    void dump(std::ostream &os, const Filter &filter = Filter()) const;
+    bool dump(const std::string &file, const Filter &filter = Filter()) const;
+    void clear();
+
+    size_t getSize() const { return m_buffer.size(); }
+    const std::string &getDumpFile() const { return m_dumpFile; }
+
+private:
+    // 记录头, 之后依次为 Logger 名称与日志文本
+    struct Header {
+        uint32_t size; // 整条记录的字节数
+        uint32_t nameLen;
+        uint64_t time;
+        uint32_t level;
+    };
+
+    void write(uint64_t pos, const void *data, size_t len);
+    void read(uint64_t pos, void *data, size_t len) const;
+
+    std::vector<char> m_buffer;
+    uint64_t m_head = 0; // 下一条的写入位置(累计字节数)
+    uint64_t m_tail = 0; // 最早一条的位置
+    mutable std::mutex m_mutex;
+    std::string m_dumpFile;
+};
+
+// 共享内存环形缓冲 Appender, 数据区与写入游标都在映射的文件中
+// 只写入映射内存, 不做同步的磁盘写; 进程崩溃或被杀死后, 已写入的内容仍在系统的文件缓存中,
+// 可用 log_recover 工具(ShmLogAppender::Recover)取出最近的日志
+//
+// 文件格式: 64 字节文件头(魔数 "SYLSHM1", 数据区字节数, 写入游标), 之后为数据区
+// 记录按 16 字节对齐, 记录头为 u64 写入位置(累计字节数, 写完后最后写入) u32 记录字节数 u32 文本字节数
+// 恢复时只认记录头中的位置与实际位置一致的记录, 未写完或已被覆盖的记录被跳过
+class ShmLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<ShmLogAppender> ptr;
+    static const size_t kDefaultSize = 4 * 1024 * 1024;
+
+    ShmLogAppender(const std::string &filename, size_t size = kDefaultSize);
+    ~ShmLogAppender();
+    void log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+    void dispatch(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event,
+                  LogRenderCache &cache) override;
+    // 请求系统把映射内容写回磁盘, 进程崩溃时不需要, 仅用于防备系统掉电
+    void flush() override;
+
+    std::string getFileName() const { return m_filename; }
+    size_t getSize() const { return m_size; }
+
+    // 按写入顺序输出文件中仍保留的日志, 文件格式不对时返回 false
+    static bool Recover(const std::string &filename, std::ostream &os);
+
+private:
+    struct Header;
+    struct Record;
+
+    void write(const char *data, size_t len);
+    void put(uint64_t pos, uint32_t size, const char *data, size_t len);
+
+    std::string m_filename;
+    size_t m_size;
+    HANDLE m_file;
+    HANDLE m_mapping = NULL;
+    Header *m_header = nullptr;
+    char *m_data = nullptr;
+};
+
+// 异步 Appender, 包装任意 Appender
+// 调用线程只把事件放入有界无锁队列, 由后台线程批量格式化并写出
+// Fatal 级别的日志会阻塞到其写出并 flush 完成
+class AsyncLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+    static const size_t kDefaultCapacity = 8192;
+
+    AsyncLogAppender(LogAppender::ptr appender, size_t capacity = kDefaultCapacity);
+    ~AsyncLogAppender();
+
+    void log(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+    // 阻塞直到此前放入队列的日志全部写出
+    void flush() override;
+    void setFormatter(LogFormatter::ptr val) override;
+
+    LogAppender::ptr getAppender() const;
+    size_t getCapacity() const;
+    uint64_t getDropped() const override;
+
+private:
+    // 队列等状态与后台线程共享, 后台线程释放最后一个事件引用时可能析构本对象
+    struct Item;
+    struct Context;
+
+    // 有丢弃时, 后台线程最多每 kDropReportInterval 毫秒写入一条汇总日志
+    static const uint64_t kDropReportInterval = 1000;
+    static void ReportDropped(Context &ctx, const std::shared_ptr<Logger> &logger);
+    static void Run(std::shared_ptr<Context> ctx);
+    static void Wakeup(Context &ctx);
+
+private:
+    std::shared_ptr<Context> m_ctx;
+    std::thread m_thread;
 };
 
 class LogManager {
     LogManager();
 
 public:
-    static std::shared_ptr<LogManager> GetInstance();
+    static const std::shared_ptr<LogManager> &GetInstance();
 
     Logger::ptr getLogger(const std::string &name);
 
     Logger::ptr getRoot() { return m_root; }
 
     std::string toJsonString() const;
+    // 各 Logger 的 Appender 按 Overflow 策略丢弃的日志条数, 只列出有丢弃的
+    std::map<std::string, uint64_t> getDropped() const;
+    // 日志系统自身的统计: 各 Logger 各级别条数, 各 Appender 写出字节数与丢弃数, 格式化与写出耗时分布
+    std::string statsJson() const;
 
     void init();
 
 private:
-    std::map<std::string, Logger::ptr> m_loggers;
+    typedef std::map<std::string, Logger::ptr> LoggerMap;
+    // 当前 Logger 表的快照, 取自每线程缓存, 表未变化时不加锁
+    std::shared_ptr<const LoggerMap> snapshot() const;
+    // 写时复制: 新建 Logger 时在 m_mutex 下复制出新表替换, 并递增 m_version
+    std::shared_ptr<const LoggerMap> m_loggers;
+    std::atomic<uint64_t> m_version;
+    mutable std::mutex m_mutex;
     Logger::ptr m_root;
 };
 
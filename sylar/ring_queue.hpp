@@ -0,0 +1,105 @@
+#ifndef __SYLAR_RING_QUEUE_HPP__
+#define __SYLAR_RING_QUEUE_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sylar {
+
+// 有界无锁环形队列 (Vyukov), 支持多生产者多消费者
+// 容量向上取整为 2 的幂
+template <typename T>
+class RingQueue {
+public:
+    explicit RingQueue(size_t capacity)
+        : m_cells(RoundUp(capacity)), m_mask(m_cells.size() - 1) {
+        for (size_t i = 0; i < m_cells.size(); ++i) {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_enqueuePos.store(0, std::memory_order_relaxed);
+        m_dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    RingQueue(const RingQueue &) = delete;
+    RingQueue &operator=(const RingQueue &) = delete;
+
+    // 队列满时返回 false
+    bool push(T &&val) {
+        Cell *cell;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(val);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空时返回 false
+    bool pop(T &val) {
+        Cell *cell;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        val = std::move(cell->data);
+        cell->data = T();
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // 近似值, 仅供统计
+    size_t size() const {
+        size_t e = m_enqueuePos.load(std::memory_order_relaxed);
+        size_t d = m_dequeuePos.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static size_t RoundUp(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    // 生产者与消费者的游标分处不同缓存行, 避免伪共享
+    char m_pad0[64];
+    std::vector<Cell> m_cells;
+    size_t m_mask;
+    char m_pad1[64];
+    std::atomic<size_t> m_enqueuePos;
+    char m_pad2[64];
+    std::atomic<size_t> m_dequeuePos;
+    char m_pad3[64];
+};
+
+} // namespace sylar
+
+#endif // __SYLAR_RING_QUEUE_HPP__
@@ -1,4 +1,11 @@
 #include "./util.h"
+#include <atomic>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define SYLAR_HAVE_TSC 1
+#endif
 
 namespace sylar {
 
@@ -10,4 +17,144 @@ DWORD GetFiberId() {
     return 0;
 }
 
-} // namespace sylar
\ No newline at end of file
+uint64_t GetCurrentMS() {
+    return GetTickCount64();
+}
+
+namespace {
+
+uint64_t QpcNS() {
+    static LARGE_INTEGER freq = []() {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return f;
+    }();
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    uint64_t c = counter.QuadPart, f = freq.QuadPart;
+    return c / f * 1000000000ull + c % f * 1000000000ull / f;
+}
+
+// 系统时间(Unix 纪元纳秒)
+uint64_t SystemNS() {
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    // FILETIME 为 1601 年起的 100ns 数
+    return (t - 116444736000000000ull) * 100;
+}
+
+struct Clock {
+    enum Mode { kCalibrating, kTsc, kQpc };
+    std::atomic<int> mode;         // 校准完成前使用 QPC
+    std::atomic<bool> calibrating; // 已有线程在完成校准
+    uint64_t tscStart = 0;         // 开始校准时的 TSC 读数
+    uint64_t nsStart = 0;          // 开始校准时的 QPC 纳秒数
+    uint64_t tscBase = 0;          // 校准完成时的 TSC 读数, mode 为 kTsc 后只读
+    uint64_t nsBase = 0;           // 校准完成时的 QPC 纳秒数
+    double nsPerTick = 0;
+    uint64_t start = 0;            // 进程启动时的单调时钟
+    std::atomic<int64_t> offset;    // 实时时钟 - 单调时钟
+    std::atomic<uint64_t> lastSync; // 上次校对时的单调时钟
+
+    // 不在构造时忙等校准: 记下起点, 之后的调用先用 QPC, 距起点超过 10ms 时由一个调用完成校准
+    Clock() : mode(kQpc), calibrating(false) {
+#ifdef SYLAR_HAVE_TSC
+        // 只使用不变 TSC (CPUID 0x80000007 EDX bit 8), 其频率不随调频和休眠变化
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax >= 0x80000007 &&
+            __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8))) {
+            QpcNS();
+            Sample(tscStart, nsStart);
+            mode = kCalibrating;
+        }
+#endif
+        start = now();
+        offset = (int64_t)(SystemNS() - start);
+        lastSync = start;
+    }
+
+#ifdef SYLAR_HAVE_TSC
+    // QPC 读数与前后两次 TSC 读数的中点配对
+    static void Sample(uint64_t &tsc, uint64_t &ns) {
+        uint64_t before = __rdtsc();
+        ns = QpcNS();
+        tsc = before + (__rdtsc() - before) / 2;
+    }
+
+    void calibrate(uint64_t t1, uint64_t n1) {
+        bool expected = false;
+        if (!calibrating.compare_exchange_strong(expected, true, std::memory_order_relaxed)) return;
+        if (t1 > tscStart) {
+            tscBase = t1;
+            nsBase = n1;
+            nsPerTick = (double)(n1 - nsStart) / (t1 - tscStart);
+            mode.store(kTsc, std::memory_order_release);
+        } else {
+            mode.store(kQpc, std::memory_order_release);
+        }
+    }
+#endif
+
+    uint64_t now() {
+#ifdef SYLAR_HAVE_TSC
+        int m = mode.load(std::memory_order_acquire);
+        if (m == kTsc) return nsBase + (int64_t)((int64_t)(__rdtsc() - tscBase) * nsPerTick);
+        if (m == kCalibrating) {
+            uint64_t t, n;
+            Sample(t, n);
+            if (n - nsStart >= 10000000) calibrate(t, n);
+            return n;
+        }
+#endif
+        return QpcNS();
+    }
+
+    uint64_t realtime(uint64_t mono) {
+        uint64_t last = lastSync.load(std::memory_order_relaxed);
+        if (mono > last && mono - last > 1000000000ull &&
+            lastSync.compare_exchange_strong(last, mono, std::memory_order_relaxed)) {
+            int64_t cur = offset.load(std::memory_order_relaxed);
+            int64_t fresh = (int64_t)(SystemNS() - mono);
+            // 系统时间精度有限, 只跟随明显的调整
+            if (fresh - cur > 20000000 || cur - fresh > 20000000) {
+                offset.store(fresh, std::memory_order_relaxed);
+            }
+        }
+        return mono + offset.load(std::memory_order_relaxed);
+    }
+};
+
+// 进程启动时初始化, 使 start 为进程启动时间; 构造不校准, 不会拖慢启动
+Clock &GetClock() {
+    static Clock *s_clock = new Clock;
+    return *s_clock;
+}
+
+Clock &s_clock_init = GetClock();
+
+} // namespace
+
+uint64_t GetMonotonicNS() {
+    return GetClock().now();
+}
+
+uint64_t GetElapsedNS() {
+    Clock &clock = GetClock();
+    return clock.now() - clock.start;
+}
+
+uint64_t GetStartNS() {
+    return GetClock().start;
+}
+
+uint64_t GetRealtimeNS() {
+    Clock &clock = GetClock();
+    return clock.realtime(clock.now());
+}
+
+uint64_t MonotonicToRealtimeNS(uint64_t monotonic_ns) {
+    return GetClock().realtime(monotonic_ns);
+}
+
+} // namespace sylar
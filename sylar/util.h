@@ -1,6 +1,12 @@
 #ifndef __SYLAR_UTIL_H__
 #define __SYLAR_UTIL_H__
 
+#include <cstdint>
+
+// GetTickCount64 / SetFileInformationByHandle 需要 Vista 及以上
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
 #include <windows.h>
 
 namespace sylar {
@@ -8,6 +14,21 @@ namespace sylar {
 DWORD GetThreadId();
 DWORD GetFiberId();
 
+// 单调时钟毫秒数
+uint64_t GetCurrentMS();
+
+// 单调时钟纳秒数, CPU 支持不变 TSC 时由 TSC 换算(无系统调用), 否则使用 QueryPerformanceCounter
+uint64_t GetMonotonicNS();
+// 进程启动以来的纳秒数
+uint64_t GetElapsedNS();
+// 进程启动时的单调时钟读数
+uint64_t GetStartNS();
+// 实时时钟纳秒数(Unix 纪元), 由单调时钟加偏移得到
+// 偏移每秒与系统时间校对一次, 仅在系统时间被调整(相差超过 20ms)时更新, 保持平滑
+uint64_t GetRealtimeNS();
+// 把一次单调时钟读数换算为实时时钟
+uint64_t MonotonicToRealtimeNS(uint64_t monotonic_ns);
+
 }
 
 #endif // __SYLAR_UTIL_H__
\ No newline at end of file
@@ -25,5 +25,13 @@ int main() {
     auto l = sylar::LogManager::GetInstance()->getLogger("xx");
     SYLAR_LOG_INFO(l) << "xxx";
 
+    sylar::Logger::ptr async_logger(new sylar::Logger("async"));
+    async_logger->addAppender(sylar::LogAppender::ptr(new sylar::AsyncLogAppender(
+        sylar::LogAppender::ptr(new sylar::FileLogAppender("./async_log.txt")), 1024)));
+    for (int i = 0; i < 10000; ++i) {
+        SYLAR_LOG_INFO(async_logger) << "async " << i;
+    }
+    SYLAR_LOG_FATAL(async_logger) << "async fatal is written before return";
+
     return 0;
 }
\ No newline at end of file
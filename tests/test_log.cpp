@@ -0,0 +1,459 @@
+#include "../sylar/config.h"
+#include "../sylar/log.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+static int g_failed = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cout << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+            ++g_failed; \
+        } \
+    } while (0)
+
+// 两次加载配置: 未变化的 Appender 保持原对象, 变化的被替换
+void test_reload() {
+    nlohmann::json conf = nlohmann::json::parse(R"({"logs": [{"name": "test.reload", "level": "INFO", "appenders": [
+        {"type": "FileLogAppender", "file": "test_reload_a.txt"},
+        {"type": "FileLogAppender", "file": "test_reload_b.txt"}]}]})");
+    sylar::Config::LoadFromJson(conf);
+    sylar::Logger::ptr logger = SYLAR_LOG_NAME("test.reload");
+    auto before = logger->getAppenders();
+    CHECK(before->size() == 2);
+
+    conf["logs"][0]["appenders"][1]["level"] = "ERROR";
+    sylar::Config::LoadFromJson(conf);
+    auto after = logger->getAppenders();
+    CHECK(after->size() == 2);
+    if (before->size() == 2 && after->size() == 2) {
+        CHECK((*after)[0] == (*before)[0]);
+        CHECK((*after)[1] != (*before)[1]);
+        CHECK((*after)[1]->getLevel() == sylar::LogLevel::Error);
+    }
+
+    sylar::Config::LoadFromJson(nlohmann::json::parse(R"({"logs": []})"));
+    remove("test_reload_a.txt");
+    remove("test_reload_b.txt");
+}
+
+static const int kShmLines = 10000;
+
+// 子进程: 写入后直接终止, 不执行任何析构, 由系统关闭句柄, 模拟进程崩溃
+static int shm_writer() {
+    sylar::Logger::ptr logger(new sylar::Logger("test.shm"));
+    sylar::LogAppender::ptr appender(new sylar::ShmLogAppender("test_shm.txt", 64 * 1024));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    logger->addAppender(appender);
+    for (int i = 0; i < kShmLines; ++i) {
+        SYLAR_LOG_INFO(logger) << "shm line " << i;
+    }
+    TerminateProcess(GetCurrentProcess(), 0);
+    return 1;
+}
+
+// 模拟崩溃: 子进程写入后直接终止, 从文件恢复, 应得到最近写入的连续日志
+void test_shm_recover() {
+    remove("test_shm.txt");
+    char path[MAX_PATH];
+    CHECK(GetModuleFileNameA(NULL, path, sizeof(path)) > 0);
+    std::string cmd = std::string("\"") + path + "\" shm_writer";
+    STARTUPINFOA si;
+    PROCESS_INFORMATION pi;
+    memset(&si, 0, sizeof(si));
+    si.cb = sizeof(si);
+    if (!CreateProcessA(path, &cmd[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
+        CHECK(false);
+        return;
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD code = 1;
+    CHECK(GetExitCodeProcess(pi.hProcess, &code) && code == 0);
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+
+    std::stringstream ss;
+    CHECK(sylar::ShmLogAppender::Recover("test_shm.txt", ss));
+    std::string line, last;
+    int count = 0, first = -1;
+    bool ordered = true;
+    while (std::getline(ss, line)) {
+        int n = -1;
+        sscanf(line.c_str(), "shm line %d", &n);
+        if (first < 0) first = n;
+        ordered = ordered && n == first + count;
+        ++count;
+        last = line;
+    }
+    CHECK(ordered);
+    CHECK(count > 0 && count < kShmLines); // 缓冲已回绕, 只保留最近的部分
+    CHECK(first + count == kShmLines);
+    CHECK(last == "shm line " + std::to_string(kShmLines - 1));
+    // 写入进程已退出, 文件不再被占用
+    CHECK(remove("test_shm.txt") == 0);
+}
+
+// 把格式化结果逐条保存, 用于检查输出内容
+class StringLogAppender : public sylar::LogAppender {
+public:
+    typedef std::shared_ptr<StringLogAppender> ptr;
+    void log(const std::shared_ptr<sylar::Logger> &logger, sylar::LogLevel::Level level, const sylar::LogEvent::ptr &event) override {
+        std::string str;
+        m_formatter->format(str, logger, level, event);
+        m_lines.push_back(str);
+    }
+
+    std::vector<std::string> m_lines;
+};
+
+static sylar::Logger::ptr NewStringLogger(const std::string &name, StringLogAppender::ptr &appender,
+                                          const std::string &pattern = "%m") {
+    sylar::Logger::ptr logger(new sylar::Logger(name));
+    appender.reset(new StringLogAppender);
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter(pattern)));
+    logger->addAppender(appender);
+    return logger;
+}
+
+static bool FileExists(const std::string &file) {
+    return std::ifstream(file).good();
+}
+
+static std::string ReadFile(const std::string &file) {
+    std::ifstream ifs(file, std::ios::binary);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+// 按大小切分, 只保留 max_files 个旧文件, 最新的日志在当前文件末尾
+void test_rolling() {
+    const char *names[] = {"test_roll.txt", "test_roll.txt.1", "test_roll.txt.2", "test_roll.txt.3"};
+    for (auto i : names) remove(i);
+    {
+        sylar::Logger::ptr logger(new sylar::Logger("test.roll"));
+        sylar::LogAppender::ptr appender(
+            new sylar::RollingFileLogAppender("test_roll.txt", sylar::RollingFileLogAppender::Size, 4096, 2));
+        appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+        logger->addAppender(appender);
+        for (int i = 0; i < 2000; ++i) {
+            // 下一个文件由后台线程准备, 未准备好时会继续写当前文件;
+            // 等文件出现后再留出句柄交接的时间, 使切分位置确定
+            if (!FileExists("test_roll.txt.next")) {
+                for (int n = 0; n < 1000 && !FileExists("test_roll.txt.next"); ++n) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+            SYLAR_LOG_INFO(logger) << "roll line " << i;
+        }
+    }
+    CHECK(FileExists("test_roll.txt"));
+    CHECK(FileExists("test_roll.txt.1"));
+    CHECK(FileExists("test_roll.txt.2"));
+    CHECK(!FileExists("test_roll.txt.3"));
+    CHECK(!FileExists("test_roll.txt.next"));
+    std::string cur = ReadFile("test_roll.txt");
+    std::string old = ReadFile("test_roll.txt.1");
+    CHECK(cur.size() <= 4096 + 64);
+    CHECK(old.size() <= 4096 + 64);
+    std::string tail = "roll line 1999\n";
+    CHECK(cur.size() >= tail.size() && cur.compare(cur.size() - tail.size(), tail.size(), tail) == 0);
+    for (auto i : names) remove(i);
+}
+
+// 重新打开后接着写, 文件中间与末尾都不应留下映射扩展出的空字节
+void test_mmap_reopen() {
+    remove("test_mmap.txt");
+    for (int round = 0; round < 2; ++round) {
+        sylar::Logger::ptr logger(new sylar::Logger("test.mmap"));
+        sylar::LogAppender::ptr appender(new sylar::MmapLogAppender("test_mmap.txt"));
+        appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+        logger->addAppender(appender);
+        for (int i = 0; i < 1000; ++i) {
+            SYLAR_LOG_INFO(logger) << "mmap line " << round * 1000 + i;
+        }
+    }
+    std::string data = ReadFile("test_mmap.txt");
+    CHECK(data.find('\0') == std::string::npos);
+    std::stringstream ss(data);
+    std::string line;
+    int count = 0;
+    bool ordered = true;
+    while (std::getline(ss, line)) {
+        ordered = ordered && line == "mmap line " + std::to_string(count);
+        ++count;
+    }
+    CHECK(ordered);
+    CHECK(count == 2000);
+    remove("test_mmap.txt");
+}
+
+// 采样与限流: 输出条数与 "[suppressed N]" 前缀
+void test_sampling() {
+    StringLogAppender::ptr appender;
+    sylar::Logger::ptr logger = NewStringLogger("test.sample", appender);
+    for (int i = 0; i < 100; ++i) {
+        SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::Info, 10) << "n" << i;
+    }
+    CHECK(appender->m_lines.size() == 10);
+    if (appender->m_lines.size() == 10) {
+        CHECK(appender->m_lines[0] == "n0");
+        CHECK(appender->m_lines[1] == "[suppressed 9] n10");
+    }
+
+    appender->m_lines.clear();
+    for (int i = 0; i < 100; ++i) {
+        SYLAR_LOG_FIRST_N(logger, sylar::LogLevel::Info, 3) << "f" << i;
+    }
+    CHECK(appender->m_lines.size() == 3);
+
+    // 每秒 5 条, 允许 5 条的突发
+    appender->m_lines.clear();
+    for (int i = 0; i < 101; ++i) {
+        if (i == 100) std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        SYLAR_LOG_RATE_LIMITED(logger, sylar::LogLevel::Info, 5) << "r" << i;
+    }
+    CHECK(appender->m_lines.size() == 6);
+    if (appender->m_lines.size() == 6) {
+        CHECK(appender->m_lines[5] == "[suppressed 95] r100");
+    }
+
+    // Logger 的配置覆盖宏中的参数
+    appender->m_lines.clear();
+    logger->setEveryN(50);
+    for (int i = 0; i < 100; ++i) {
+        SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::Info, 10) << "o" << i;
+    }
+    CHECK(appender->m_lines.size() == 2);
+}
+
+// 结构化字段按 logfmt 与 JSON 输出
+void test_fields() {
+    StringLogAppender::ptr text, json;
+    sylar::Logger::ptr logger = NewStringLogger("test.fields", text, "%m %k");
+    json.reset(new StringLogAppender);
+    json->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%k{json}")));
+    logger->addAppender(json);
+    SYLAR_LOG_INFO(logger).kv("user", "bob").kv("n", 42).kv("ok", true).kv("msg", "a b\"c") << "login";
+    CHECK(text->m_lines.size() == 1 && text->m_lines[0] == "login user=bob n=42 ok=true msg=\"a b\\\"c\"");
+    CHECK(json->m_lines.size() == 1 && json->m_lines[0] == "{\"user\":\"bob\",\"n\":42,\"ok\":true,\"msg\":\"a b\\\"c\"}");
+}
+
+// 层级: 未配置的级别与 Appender 继承自最近的祖先, 后创建的中间级会接管已有的后代
+void test_hierarchy() {
+    sylar::Logger::ptr child = SYLAR_LOG_NAME("hier.a.b");
+    CHECK(child->getParent() == SYLAR_LOG_ROOT());
+    sylar::Logger::ptr parent = SYLAR_LOG_NAME("hier.a");
+    CHECK(child->getParent() == parent);
+    CHECK(parent->getParent() == SYLAR_LOG_ROOT());
+
+    StringLogAppender::ptr appender(new StringLogAppender);
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%c %m")));
+    parent->addAppender(appender);
+    parent->setLevel(sylar::LogLevel::Error);
+    CHECK(child->getEffectiveLevel() == sylar::LogLevel::Error);
+    SYLAR_LOG_INFO(child) << "info";
+    SYLAR_LOG_ERROR(child) << "error";
+    CHECK(appender->m_lines.size() == 1 && appender->m_lines[0] == "hier.a.b error");
+
+    // 自身的配置优先
+    child->setLevel(sylar::LogLevel::Debug);
+    SYLAR_LOG_INFO(child) << "info";
+    CHECK(appender->m_lines.size() == 2);
+    StringLogAppender::ptr own(new StringLogAppender);
+    own->setFormatter(appender->getFormatter());
+    child->addAppender(own);
+    SYLAR_LOG_INFO(child) << "own";
+    CHECK(own->m_lines.size() == 1);
+    CHECK(appender->m_lines.size() == 2);
+
+    // 恢复继承
+    child->clearAppender();
+    child->setLevel(sylar::LogLevel::Unknow);
+    SYLAR_LOG_INFO(child) << "info";
+    SYLAR_LOG_FATAL(child) << "fatal";
+    CHECK(appender->m_lines.size() == 3 && appender->m_lines[2] == "hier.a.b fatal");
+    parent->clearAppender();
+}
+
+// 环形缓冲: 回绕后只保留最近的日志, 按级别 / Logger / 时间过滤, Fatal 时导出到文件
+void test_ring_buffer() {
+    remove("test_ring.txt");
+    sylar::RingBufferLogAppender::ptr ring(new sylar::RingBufferLogAppender(4096, "test_ring.txt"));
+    ring->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%c %m%n")));
+    sylar::Logger::ptr a(new sylar::Logger("ring.a"));
+    sylar::Logger::ptr ax(new sylar::Logger("ring.a.x"));
+    sylar::Logger::ptr ab(new sylar::Logger("ring.ab"));
+    a->addAppender(ring);
+    ax->addAppender(ring);
+    ab->addAppender(ring);
+
+    for (int i = 0; i < 1000; ++i) {
+        SYLAR_LOG_INFO(a) << "fill " << i;
+    }
+    auto all = ring->query();
+    CHECK(!all.empty() && all.size() < 1000);
+    CHECK(!all.empty() && all.back().text == "ring.a fill 999\n");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    uint64_t begin = sylar::GetRealtimeNS();
+    SYLAR_LOG_ERROR(a) << "e1";
+    SYLAR_LOG_INFO(ax) << "i1";
+    SYLAR_LOG_ERROR(ab) << "e2";
+
+    sylar::RingBufferLogAppender::Filter filter;
+    filter.begin = begin;
+    CHECK(ring->query(filter).size() == 3);
+    filter.level = sylar::LogLevel::Error;
+    CHECK(ring->query(filter).size() == 2);
+    filter.level = sylar::LogLevel::Unknow;
+    filter.logger = "ring.a";
+    auto recs = ring->query(filter);
+    CHECK(recs.size() == 2);
+    if (recs.size() == 2) {
+        CHECK(recs[0].logger == "ring.a" && recs[1].logger == "ring.a.x");
+    }
+    std::stringstream ss;
+    ring->dump(ss, filter);
+    CHECK(ss.str() == "ring.a e1\nring.a.x i1\n");
+
+    SYLAR_LOG_FATAL(ab) << "crash";
+    std::string dumped = ReadFile("test_ring.txt");
+    std::string tail = "ring.ab crash\n";
+    CHECK(dumped.size() > tail.size() && dumped.compare(dumped.size() - tail.size(), tail.size(), tail) == 0);
+    remove("test_ring.txt");
+}
+
+// 写出很慢的 Appender, 用于让异步队列写满
+class SlowLogAppender : public sylar::LogAppender {
+public:
+    typedef std::shared_ptr<SlowLogAppender> ptr;
+    void log(const std::shared_ptr<sylar::Logger> &logger, sylar::LogLevel::Level level, const sylar::LogEvent::ptr &event) override {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        ++m_count[level];
+    }
+
+    int m_count[sylar::LogLevel::Fatal + 1] = {0};
+};
+
+// DropOldest: 丢弃数与未送达的 Info 条数一致, Error 不被丢弃
+void test_drop_oldest() {
+    SlowLogAppender::ptr slow(new SlowLogAppender);
+    sylar::AsyncLogAppender::ptr async(new sylar::AsyncLogAppender(slow, 64));
+    async->setOverflow(sylar::LogAppender::DropOldest);
+    sylar::Logger::ptr logger(new sylar::Logger("test.drop"));
+    logger->addAppender(async);
+    int infos = 0, errors = 0;
+    for (int i = 0; i < 3000; ++i) {
+        if (i % 10 == 0) {
+            SYLAR_LOG_ERROR(logger) << i;
+            ++errors;
+        } else {
+            SYLAR_LOG_INFO(logger) << i;
+            ++infos;
+        }
+    }
+    async->flush();
+    uint64_t dropped = async->getDropped();
+    uint64_t lost = infos - slow->m_count[sylar::LogLevel::Info];
+    CHECK(dropped > 0);
+    CHECK(slow->m_count[sylar::LogLevel::Error] == errors);
+    CHECK(dropped == lost);
+    // 丢弃汇总由后台线程直接写出, 不经过队列
+    CHECK(slow->m_count[sylar::LogLevel::Warn] >= 1);
+}
+
+// 同一文件的两个 FileLogAppender 共用写出端, 并发写入时每行完整
+void test_shared_sink() {
+    remove("test_sink.txt");
+    const int kLines = 5000;
+    {
+        sylar::Logger::ptr l1(new sylar::Logger("test.sink1"));
+        sylar::Logger::ptr l2(new sylar::Logger("test.sink2"));
+        sylar::LogAppender::ptr a1(new sylar::FileLogAppender("test_sink.txt"));
+        sylar::LogAppender::ptr a2(new sylar::FileLogAppender("./test_sink.txt"));
+        a1->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%c %m%n")));
+        a2->setFormatter(a1->getFormatter());
+        l1->addAppender(a1);
+        l2->addAppender(a2);
+        CHECK(sylar::LogFileSink::Get("test_sink.txt") == sylar::LogFileSink::Get("./test_sink.txt"));
+
+        std::thread t([&l2]() {
+            for (int i = 0; i < kLines; ++i) {
+                SYLAR_LOG_INFO(l2) << "sink line " << i;
+            }
+        });
+        for (int i = 0; i < kLines; ++i) {
+            SYLAR_LOG_INFO(l1) << "sink line " << i;
+        }
+        t.join();
+    }
+    std::stringstream ss(ReadFile("test_sink.txt"));
+    std::string line;
+    int next[2] = {0, 0};
+    bool ordered = true;
+    while (std::getline(ss, line)) {
+        int n = -1;
+        char c = 0;
+        if (sscanf(line.c_str(), "test.sink%c sink line %d", &c, &n) != 2 || (c != '1' && c != '2')) {
+            ordered = false;
+            break;
+        }
+        ordered = ordered && n == next[c - '1']++;
+    }
+    CHECK(ordered);
+    CHECK(next[0] == kLines && next[1] == kLines);
+    remove("test_sink.txt");
+}
+
+void test_flush_interval() {
+    remove("test_interval.txt");
+    const uint64_t kInterval = 50;
+    sylar::Logger::ptr logger(new sylar::Logger("test.interval"));
+    sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender("test_interval.txt"));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    sylar::FileLogAppender::FlushPolicy policy;
+    policy.bytes = 64 * 1024;
+    policy.interval = kInterval;
+    appender->setFlushPolicy(policy);
+    logger->addAppender(appender);
+
+    SYLAR_LOG_INFO(logger) << "interval line";
+    CHECK(ReadFile("test_interval.txt").empty());
+    // 没有后续日志, 由后台线程在间隔内写出
+    bool written = false;
+    for (uint64_t i = 0; i < kInterval * 4 && !written; i += 10) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        written = ReadFile("test_interval.txt") == "interval line\n";
+    }
+    CHECK(written);
+    logger->clearAppender();
+    appender.reset();
+    remove("test_interval.txt");
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "shm_writer") return shm_writer();
+
+    test_reload();
+    test_shm_recover();
+    test_rolling();
+    test_mmap_reopen();
+    test_sampling();
+    test_fields();
+    test_hierarchy();
+    test_ring_buffer();
+    test_drop_oldest();
+    test_shared_sink();
+    test_flush_interval();
+
+    std::cout << (g_failed ? "FAILED" : "OK") << std::endl;
+    return g_failed ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#include "../sylar/log.h"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// 统计全局 operator new 调用次数
+// 本程序直接编译了 sylar 源码, 库内的分配同样会被统计到
+static std::atomic<size_t> s_allocs(0);
+
+void *operator new(size_t size) {
+    ++s_allocs;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+// 只格式化不写出的 Appender, 复用格式化缓冲
+class NullLogAppender : public sylar::LogAppender {
+public:
+    void log(const std::shared_ptr<sylar::Logger> &logger, sylar::LogLevel::Level level, const sylar::LogEvent::ptr &event) override {
+        m_buf.clear();
+        m_formatter->format(m_buf, logger, level, event);
+    }
+
+private:
+    std::string m_buf;
+};
+
+static const int kLines = 100000;
+
+// 返回稳态下每条日志的分配次数
+template <typename F>
+static double measure(const char *name, F f) {
+    f(); // 预热, 让池和缓冲达到稳定容量
+    size_t before = s_allocs;
+    for (int i = 0; i < kLines; ++i) {
+        f();
+    }
+    size_t count = s_allocs - before;
+    std::cout << name << ": " << (double)count / kLines << " allocations/line" << std::endl;
+    return (double)count / kLines;
+}
+
+int main() {
+    sylar::Logger::ptr logger(new sylar::Logger("alloc"));
+    logger->addAppender(sylar::LogAppender::ptr(new NullLogAppender));
+
+    int failed = 0;
+
+    // 参照: 不经过池直接构造事件, 每条日志 new 一个 LogEvent 及其 shared_ptr 控制块
+    // 只作对比, 不代表池化之前宏的完整开销
+    measure("unpooled LogEvent ", [&]() {
+        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, sylar::LogLevel::Info, __FILE__, __LINE__, 0,
+                                                                     sylar::GetThreadId(), sylar::GetFiberId(), time(0))))
+                .getSS()
+            << "alloc test " << 42;
+    });
+
+    // 宏从线程本地池取事件, 稳态下不应有分配
+    if (measure("SYLAR_LOG_INFO    ", [&]() {
+            SYLAR_LOG_INFO(logger) << "alloc test " << 42;
+        }) != 0) {
+        ++failed;
+    }
+
+    if (measure("SYLAR_LOG_FMT_INFO", [&]() {
+            SYLAR_LOG_FMT_INFO(logger, "alloc test %d", 42);
+        }) != 0) {
+        ++failed;
+    }
+
+    // 池中的事件不应让局部 Logger 在作用域结束后仍存活
+    std::weak_ptr<sylar::Logger> weak;
+    {
+        sylar::Logger::ptr scoped(new sylar::Logger("scoped"));
+        scoped->addAppender(sylar::LogAppender::ptr(new NullLogAppender));
+        weak = scoped;
+        SYLAR_LOG_INFO(scoped) << "scoped logger";
+    }
+    std::cout << "scoped logger released: " << (weak.expired() ? "yes" : "no") << std::endl;
+    if (!weak.expired()) ++failed;
+
+    std::cout << (failed ? "FAILED" : "OK") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+#include "../sylar/log.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+
+static const int kLoops = 1000000;
+
+template <typename F>
+static void bench(const char *name, F f) {
+    auto begin = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (int i = 0; i < kLoops; ++i) {
+        bytes += f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    std::cout << name << ": " << ns / kLoops << " ns/line, " << kLoops / (ns / 1e9) << " lines/s, "
+              << bytes << " bytes" << std::endl;
+}
+
+int main() {
+    sylar::Logger::ptr logger(new sylar::Logger("bench"));
+    sylar::LogEvent::ptr event(new sylar::LogEvent(logger, sylar::LogLevel::Info, __FILE__, __LINE__, 0,
+                                                   sylar::GetThreadId(), sylar::GetFiberId(), time(0)));
+    event->getSS() << "format throughput benchmark message " << 12345;
+
+    const char *patterns[] = {
+        "%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n",
+        "%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n",
+    };
+    for (auto pattern : patterns) {
+        sylar::LogFormatter::ptr fmt(new sylar::LogFormatter(pattern));
+        std::cout << "pattern: " << pattern << std::endl;
+
+        // FormatItem 逐项虚调用, 每行新建 stringstream
+        bench("  FormatItem", [&]() {
+            std::stringstream ss;
+            fmt->format(ss, logger, sylar::LogLevel::Info, event);
+            return ss.str().size();
+        });
+
+        // 编译后的指令, 追加到复用的缓冲
+        std::string buf;
+        bench("  compiled  ", [&]() {
+            buf.clear();
+            fmt->format(buf, logger, sylar::LogLevel::Info, event);
+            return buf.size();
+        });
+    }
+
+    // 二进制日志: SYLAR_LOG_FMT_* 每次调用的开销, 及 BinLog::Write 内各步骤单独的开销
+    sylar::BinLog::Open("bench.bin");
+    logger->setBinary(true);
+    std::cout << "binlog" << std::endl;
+    bench("  SYLAR_LOG_FMT_INFO", [&]() {
+        SYLAR_LOG_FMT_INFO(logger, "format throughput benchmark message %d", 12345);
+        return 0;
+    });
+    static sylar::BinLog::Site site;
+    uint32_t site_id = sylar::BinLog::GetSiteId(site, sylar::LogLevel::Info, __FILE__, __LINE__,
+                                                "format throughput benchmark message %d");
+    uint32_t logger_id = logger->getBinLogId();
+    bench("  BinLog::Write     ", [&]() {
+        sylar::BinLog::Write(logger_id, site_id, sylar::LogLevel::Info, 12345);
+        return 0;
+    });
+    std::mutex mutex;
+    bench("    mutex lock      ", [&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return 0;
+    });
+    bench("    GetRealtimeNS   ", [&]() {
+        return (size_t)(sylar::GetRealtimeNS() & 1);
+    });
+    bench("    GetThreadId     ", [&]() {
+        return (size_t)(sylar::GetThreadId() & 1);
+    });
+    logger->setBinary(false);
+    sylar::BinLog::Close();
+    remove("bench.bin");
+    return 0;
+}
@@ -0,0 +1,280 @@
+// 二进制日志解码工具
+// 用法: log_decode <binlog 文件> [pattern]
+// 按记录中 Logger 的 pattern(或命令行指定的 pattern)还原文本日志, 输出到标准输出
+#include "../sylar/binlog.h"
+#include "../sylar/log.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+struct Arg {
+    char type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+    std::string s;
+};
+
+struct SiteDefine {
+    sylar::LogLevel::Level level; // 注册时的级别, 输出以事件记录的级别为准
+    int32_t line;
+    std::string file;
+    std::string fmt;
+};
+
+struct LoggerDefine {
+    sylar::Logger::ptr logger;
+    sylar::LogFormatter::ptr formatter;
+};
+
+class Reader {
+public:
+    Reader(const std::string &data) : m_data(data), m_pos(0) {}
+
+    bool eof() const { return m_pos >= m_data.size(); }
+    bool ok() const { return m_ok; }
+
+    template <typename T>
+    T read() {
+        T v = T();
+        if (m_pos + sizeof(T) > m_data.size()) {
+            m_ok = false;
+            m_pos = m_data.size();
+            return v;
+        }
+        memcpy(&v, m_data.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return v;
+    }
+
+    std::string readString(size_t len) {
+        if (m_pos + len > m_data.size()) {
+            m_ok = false;
+            m_pos = m_data.size();
+            return std::string();
+        }
+        std::string s = m_data.substr(m_pos, len);
+        m_pos += len;
+        return s;
+    }
+
+    std::string readString16() { return readString(read<uint16_t>()); }
+
+private:
+    const std::string &m_data;
+    size_t m_pos;
+    bool m_ok = true;
+};
+
+int64_t ToInt(const Arg &a) {
+    switch (a.type) {
+    case 'd':
+        return (int64_t)a.d;
+    case 's':
+        return 0;
+    default:
+        return a.i;
+    }
+}
+
+double ToDouble(const Arg &a) {
+    switch (a.type) {
+    case 'd':
+        return a.d;
+    case 'u':
+    case 'p':
+        return (double)a.u;
+    case 's':
+        return 0;
+    default:
+        return (double)a.i;
+    }
+}
+
+// 按 printf 规则还原, 参数按记录时的类型统一为 64 位整数/double/字符串
+std::string Format(const std::string &fmt, const std::vector<Arg> &args) {
+    std::string out;
+    size_t n = 0;
+    char buf[512];
+    for (size_t i = 0; i < fmt.size(); ++i) {
+        if (fmt[i] != '%') {
+            out.push_back(fmt[i]);
+            continue;
+        }
+        if (i + 1 < fmt.size() && fmt[i + 1] == '%') {
+            out.push_back('%');
+            ++i;
+            continue;
+        }
+        // 标志、宽度、精度, '*' 从参数中取值
+        std::string spec = "%";
+        size_t j = i + 1;
+        while (j < fmt.size() && strchr("-+ #0123456789.*", fmt[j])) {
+            if (fmt[j] == '*') {
+                spec += std::to_string(n < args.size() ? ToInt(args[n++]) : 0);
+            } else {
+                spec.push_back(fmt[j]);
+            }
+            ++j;
+        }
+        // 长度修饰符, 参数已统一宽度, 重新指定
+        while (j < fmt.size() && strchr("hlLqjzt", fmt[j])) ++j;
+        if (j >= fmt.size()) {
+            out.append(fmt, i, std::string::npos);
+            break;
+        }
+        char conv = fmt[j];
+        i = j;
+        if (conv == 'n') continue;
+        if (n >= args.size()) {
+            out.append("<?>");
+            continue;
+        }
+        const Arg &a = args[n++];
+        switch (conv) {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), (long long)ToInt(a));
+            break;
+        case 'c':
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), (int)ToInt(a));
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), ToDouble(a));
+            break;
+        case 'p':
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), (void *)(uintptr_t)a.u);
+            break;
+        case 's':
+            if (a.type == 's' && spec.size() == 1) {
+                out.append(a.s);
+                continue;
+            }
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), a.type == 's' ? a.s.c_str() : "(null)");
+            break;
+        default:
+            buf[0] = '\0';
+            break;
+        }
+        out.append(buf);
+    }
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <binlog file> [pattern]" << std::endl;
+        return 1;
+    }
+    std::ifstream ifs(argv[1], std::ios::binary);
+    if (!ifs) {
+        std::cerr << "open " << argv[1] << " failed" << std::endl;
+        return 1;
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    std::string data = ss.str();
+    if (data.size() < sizeof(sylar::BinLog::kMagic) ||
+        memcmp(data.data(), sylar::BinLog::kMagic, sizeof(sylar::BinLog::kMagic)) != 0) {
+        std::cerr << argv[1] << " is not a binlog file" << std::endl;
+        return 1;
+    }
+    data.erase(0, sizeof(sylar::BinLog::kMagic));
+
+    sylar::LogFormatter::ptr override_fmt;
+    if (argc > 2) {
+        override_fmt.reset(new sylar::LogFormatter(argv[2]));
+        if (override_fmt->is_Error()) {
+            std::cerr << "pattern " << argv[2] << " is invalid" << std::endl;
+            return 1;
+        }
+    }
+
+    std::map<uint32_t, SiteDefine> sites;
+    std::map<uint32_t, LoggerDefine> loggers;
+    std::vector<Arg> args;
+    std::string out;
+    uint64_t start_ns = 0; // 写入进程的启动时间, 没有 'P' 记录时 elapse 为 0
+    Reader r(data);
+    while (!r.eof()) {
+        char type = r.read<char>();
+        if (type == 'P') {
+            start_ns = r.read<uint64_t>();
+        } else if (type == 'S') {
+            uint32_t id = r.read<uint32_t>();
+            SiteDefine &s = sites[id];
+            s.level = (sylar::LogLevel::Level)r.read<uint8_t>();
+            s.line = r.read<int32_t>();
+            s.file = r.readString16();
+            s.fmt = r.readString16();
+        } else if (type == 'L') {
+            uint32_t id = r.read<uint32_t>();
+            LoggerDefine &l = loggers[id];
+            std::string name = r.readString16();
+            std::string pattern = r.readString16();
+            l.logger.reset(new sylar::Logger(name));
+            l.formatter.reset(new sylar::LogFormatter(pattern));
+        } else if (type == 'E') {
+            uint32_t site_id = r.read<uint32_t>();
+            uint32_t logger_id = r.read<uint32_t>();
+            sylar::LogLevel::Level level = (sylar::LogLevel::Level)r.read<uint8_t>();
+            uint32_t thread_id = r.read<uint32_t>();
+            uint32_t fiber_id = r.read<uint32_t>();
+            uint64_t ns = r.read<uint64_t>();
+            uint8_t nargs = r.read<uint8_t>();
+            args.resize(nargs);
+            for (auto &a : args) {
+                a.type = r.read<char>();
+                if (a.type == 's') {
+                    a.s = r.readString(r.read<uint32_t>());
+                } else {
+                    a.u = r.read<uint64_t>();
+                }
+            }
+            if (!r.ok()) break;
+            auto sit = sites.find(site_id);
+            auto lit = loggers.find(logger_id);
+            if (sit == sites.end() || lit == loggers.end()) {
+                std::cerr << "unknown site " << site_id << " or logger " << logger_id << std::endl;
+                continue;
+            }
+            const SiteDefine &s = sit->second;
+            const LoggerDefine &l = lit->second;
+            uint32_t elapse = start_ns && ns > start_ns ? (ns - start_ns) / 1000000 : 0;
+            sylar::LogEvent::ptr event(new sylar::LogEvent(l.logger, level, s.file.c_str(), s.line, elapse,
+                                                           thread_id, fiber_id, ns / 1000000000));
+            event->setTime(ns / 1000000000, ns % 1000000000);
+            event->getSS() << Format(s.fmt, args);
+            out.clear();
+            (override_fmt ? override_fmt : l.formatter)->format(out, l.logger, level, event);
+            std::cout << out;
+        } else {
+            std::cerr << "bad record type " << (int)type << std::endl;
+            return 1;
+        }
+    }
+    if (!r.ok()) {
+        std::cerr << "truncated record at end of file" << std::endl;
+    }
+    return 0;
+}
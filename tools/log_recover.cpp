@@ -0,0 +1,17 @@
+// 共享内存日志恢复工具
+// 用法: log_recover <ShmLogAppender 的文件>
+// 进程崩溃或被杀死后, 按写入顺序把文件中仍保留的日志输出到标准输出
+#include "../sylar/log.h"
+#include <iostream>
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <shm log file>" << std::endl;
+        return 1;
+    }
+    if (!sylar::ShmLogAppender::Recover(argv[1], std::cout)) {
+        std::cerr << argv[1] << " is not a shm log file" << std::endl;
+        return 1;
+    }
+    return 0;
+}